@@ -43,6 +43,8 @@ typedef unsigned spinlock_data_t;
 void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned inc);
 
 ////////////////////////////////////////////////////////////
 
@@ -93,5 +95,34 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned inc)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Atomic fetch-and-add using LL/SC.
+	 *
+	 * Unlike test-and-set this can't just report failure, so
+	 * retry until the SC goes through. Returns the old value.
+	 */
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slot */
+		"1: ll %0, 0(%2);"	/*   x = *sd */
+		"addu %1, %0, %3;"	/*   y = x + inc */
+		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   retry on failure */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (sd), "r" (inc) : "memory");
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
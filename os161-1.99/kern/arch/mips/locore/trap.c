@@ -44,6 +44,7 @@
 #include <addrspace.h>
 #include <proc.h>
 #include <limits.h>
+#include <kern/wait.h>
 
 /* in exception.S */
 extern void asm_usermode(struct trapframe *tf);
@@ -118,44 +119,9 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 #if OPT_A3
         (void)vaddr;
         (void)epc;
-        struct addrspace *as;
-        struct proc *p = curproc;
-        pid_t pid;
-        sys_getpid(&pid);
-        if(PID_TABLE->table[pid]->parent){
-          lock_acquire(PID_TABLE->table[pid]->e_lk);
-          PID_TABLE->table[pid]->exited = 1;
-          PID_TABLE->table[pid]->code = sig;
-          cv_signal(PID_TABLE->table[pid]->e_cv, PID_TABLE->table[pid]->e_lk);
-          spinlock_acquire(&PID_TABLE->p_spinlock);
-          for (int i =1;i<=PID_MAX;i++){
-            if (PID_TABLE->table[i] && PID_TABLE->table[i]->parent == curproc && PID_TABLE->table[i]->exited){
-              remove_pidEntry(PID_TABLE, i);
-            }
-          }
-          spinlock_release(&PID_TABLE->p_spinlock);
-          lock_release(PID_TABLE->table[pid]->e_lk);  
-        } else {
-          spinlock_acquire(&PID_TABLE->p_spinlock);
-          for (int i =1;i<=PID_MAX;i++){
-            if (PID_TABLE->table[i] && PID_TABLE->table[i]->parent == curproc && PID_TABLE->table[i]->exited){
-              remove_pidEntry(PID_TABLE, i);
-            }
-          }
-          remove_pidEntry(PID_TABLE, pid);
-          spinlock_release(&PID_TABLE->p_spinlock);
-        }
-
-
-
-        KASSERT(curproc->p_addrspace != NULL);
-        as_deactivate();
-        as = curproc_setas(NULL);
-        as_destroy(as);
-        proc_remthread(curthread);
-        proc_destroy(p);
-        thread_exit();
-        panic("return from thread_exit in sys_exit\n");
+        /* takes the whole process, not just this thread */
+        exit_curproc(_MKWAIT_SIG(sig));
+        panic("return from exit_curproc in kill_curthread\n");
 
 #elif
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
@@ -231,6 +197,8 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* for hardclock's cpu time accounting */
+		curcpu->c_intr_user = !iskern;
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
@@ -241,6 +209,12 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+		if (!iskern && curproc->p_exiting) {
+			/* back to the interrupts-on state of user mode */
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -366,6 +340,14 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * If another thread of this process has exited it, leave
+	 * instead of going back to user mode. Interrupts are on here.
+	 */
+	if (!iskern && curproc->p_exiting) {
+		exit_curproc(0);
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
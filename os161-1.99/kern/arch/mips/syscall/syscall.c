@@ -35,9 +35,13 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
+#include <percpu.h>
 #include "opt-A2.h"
 
 
+static PERCPU_COUNTER(syscall_count, "syscall");
+
 /*
  * System call dispatcher.
  *
@@ -81,6 +85,9 @@ syscall(struct trapframe *tf)
 {
 	int callno;
 	int32_t retval;
+	off_t retval64;
+	bool is64;
+	int whence;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -88,6 +95,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	percpu_counter_inc(&syscall_count);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -99,6 +107,7 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+	is64 = false;
 
 	switch (callno) {
 	    case SYS_reboot:
@@ -109,7 +118,51 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				     &retval);
+		break;
 #ifdef UW
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (mode_t)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_lseek:
+	  /* fd in a0, the 64-bit offset in a2/a3, whence on the stack */
+	  err = copyin((userptr_t)(tf->tf_sp + 16), &whence, sizeof(whence));
+	  if (!err) {
+	    err = sys_lseek((int)tf->tf_a0,
+			    ((off_t)tf->tf_a2 << 32) | tf->tf_a3,
+			    whence, &retval64);
+	  }
+	  is64 = true;
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+	case SYS_dup2:
+	  err = sys_dup2((int)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)(&retval));
+	  break;
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
 			  (userptr_t)tf->tf_a1,
@@ -130,16 +183,57 @@ syscall(struct trapframe *tf)
 			    (int)tf->tf_a2,
 			    (pid_t *)&retval);
 	  break;
+	case SYS_setshare:
+	  err = sys_setshare((pid_t)tf->tf_a0, (int)tf->tf_a1);
+	  break;
 #endif // UW
 
 #if OPT_A2
         case SYS_fork:
           err = sys_fork(tf, (pid_t *)&retval);
 	  break;
+        case SYS_vfork:
+          err = sys_vfork(tf, (pid_t *)&retval);
+	  break;
         case SYS_execv:
           err = sys_execv((userptr_t)tf->tf_a0,
                           (userptr_t)tf->tf_a1);
           break;
+        case SYS_wait4:
+          err = sys_wait4((pid_t)tf->tf_a0,
+                          (userptr_t)tf->tf_a1,
+                          (int)tf->tf_a2,
+                          (userptr_t)tf->tf_a3,
+                          (pid_t *)&retval);
+          break;
+        case SYS_getrusage:
+          err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+          break;
+        case SYS_spawn:
+          err = sys_spawn((userptr_t)tf->tf_a0,
+                          (userptr_t)tf->tf_a1,
+                          (userptr_t)tf->tf_a2,
+                          (int)tf->tf_a3,
+                          (pid_t *)&retval);
+          break;
+        case SYS___thread_create:
+          err = sys_thread_create((userptr_t)tf->tf_a0,
+                                  (userptr_t)tf->tf_a1,
+                                  (userptr_t)tf->tf_a2,
+                                  (int *)&retval);
+          break;
+        case SYS_thread_exit:
+          sys_thread_exit((userptr_t)tf->tf_a0);
+          /* sys_thread_exit does not return, execution should not get here */
+          panic("unexpected return from sys_thread_exit");
+          break;
+        case SYS_thread_join:
+          err = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+          break;
+        case SYS_procstat:
+          err = sys_procstat((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+                             (userptr_t)tf->tf_a2, (int *)&retval);
+          break;
 #endif
 
  
@@ -161,7 +255,13 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval;
+		if (is64) {
+			tf->tf_v0 = (uint32_t)(retval64 >> 32);
+			tf->tf_v1 = (uint32_t)retval64;
+		}
+		else {
+			tf->tf_v0 = retval;
+		}
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 	
@@ -192,8 +292,9 @@ enter_forked_process(void *trfr, int a)
 {
         struct trapframe tf;
         struct trapframe *trf = trfr;
-        (void)a;
         (void) trfr;
+        /* keep the forking thread's id; we're running on its stack */
+        curthread->t_tid = a;
         tf.tf_status = trf->tf_status;     /* coprocessor 0 status register */
         tf.tf_cause = trf->tf_cause;      /* coprocessor 0 cause register */
         tf.tf_lo = trf->tf_lo;
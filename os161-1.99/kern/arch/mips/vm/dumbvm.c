@@ -37,6 +37,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <percpu.h>
 #include "opt-A3.h"
 
 /*
@@ -45,12 +46,24 @@
  */
 
 /* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
+#define DUMBVM_STACKPAGES    USERSTACK_PAGES
+
+/*
+ * Stacks for the other threads of a multithreaded process go below
+ * the first thread's, 16k each, with an unmapped guard page between
+ * neighbours so that running off the end of one faults instead of
+ * scribbling on the next.
+ */
+#define DUMBVM_TSTACKPAGES   4
+#define DUMBVM_TSTACKSLOT    ((DUMBVM_TSTACKPAGES + 1) * PAGE_SIZE)
+#define DUMBVM_TSTACKTOP(tid) \
+	(USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE - \
+	 ((tid) - 1) * DUMBVM_TSTACKSLOT - PAGE_SIZE)
 
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_NAMED_INITIALIZER("stealmem");
 
 void
 vm_bootstrap(void)
@@ -105,17 +118,27 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+static PERCPU_COUNTER(vm_fault_count, "vm_fault");
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
+	unsigned tid;
 	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
 
 	faultaddress &= PAGE_FRAME;
+	percpu_counter_inc(&vm_fault_count);
+	/*
+	 * Every fault here is a TLB refill for memory that's already
+	 * resident - a minor fault. dumbvm never pages anything in, so
+	 * there are no major faults or swap-ins to count.
+	 */
+	curthread->t_usage.u_minflt++;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
 
@@ -178,6 +201,19 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
+	else if (faultaddress < stackbase &&
+		 faultaddress >= stackbase - (THREAD_MAX-1) * DUMBVM_TSTACKSLOT) {
+		/* another thread's stack, or a guard page */
+		tid = (stackbase - faultaddress - 1) / DUMBVM_TSTACKSLOT + 1;
+		stacktop = DUMBVM_TSTACKTOP(tid);
+		if (faultaddress >= stacktop ||
+		    as->as_tstackpbase[tid] == 0) {
+			return EFAULT;
+		}
+		paddr = faultaddress -
+			(stacktop - DUMBVM_TSTACKPAGES * PAGE_SIZE) +
+			as->as_tstackpbase[tid];
+	}
 	else {
 		return EFAULT;
 	}
@@ -236,6 +272,7 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	bzero(as->as_tstackpbase, sizeof(as->as_tstackpbase));
 #if OPT_A3
         as->elf_loaded = 0;
 #endif
@@ -370,10 +407,50 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_tstack(struct addrspace *as, unsigned tid, vaddr_t *stackptr)
+{
+	KASSERT(tid > 0 && tid < THREAD_MAX);
+
+	/*
+	 * Only the thread creating thread TID touches its slot, and
+	 * the memory is never handed back, so no lock is needed.
+	 */
+	if (as->as_tstackpbase[tid] == 0) {
+		as->as_tstackpbase[tid] = getppages(DUMBVM_TSTACKPAGES);
+		if (as->as_tstackpbase[tid] == 0) {
+			return ENOMEM;
+		}
+		as_zero_region(as->as_tstackpbase[tid], DUMBVM_TSTACKPAGES);
+	}
+
+	*stackptr = DUMBVM_TSTACKTOP(tid);
+	return 0;
+}
+
+unsigned
+as_respages(struct addrspace *as)
+{
+	unsigned n, i;
+
+	/* dumbvm allocates everything up front and never pages out */
+	n = as->as_npages1 + as->as_npages2;
+	if (as->as_stackpbase != 0) {
+		n += DUMBVM_STACKPAGES;
+	}
+	for (i=1; i<THREAD_MAX; i++) {
+		if (as->as_tstackpbase[i] != 0) {
+			n += DUMBVM_TSTACKPAGES;
+		}
+	}
+	return n;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	unsigned i;
 
 	new = as_create();
 	if (new==NULL) {
@@ -406,6 +483,24 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
+
+	/*
+	 * The forking thread may be running on any of the stacks, and
+	 * data on one may point into another, so copy them all.
+	 */
+	for (i=1; i<THREAD_MAX; i++) {
+		if (old->as_tstackpbase[i] == 0) {
+			continue;
+		}
+		new->as_tstackpbase[i] = getppages(DUMBVM_TSTACKPAGES);
+		if (new->as_tstackpbase[i] == 0) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(new->as_tstackpbase[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_tstackpbase[i]),
+			DUMBVM_TSTACKPAGES*PAGE_SIZE);
+	}
 	
 	*ret = new;
 	return 0;
@@ -35,11 +35,21 @@
  */
 
 
+#include <limits.h>
 #include <vm.h>
 #include "opt-A3.h"
 
 struct vnode;
+struct fs;
 
+/*
+ * Pages of user stack a new image starts with; dumbvm never grows
+ * it. exec puts the argument block at the top, so it can only take
+ * EXEC_ARGMAX bytes of it - less than ARG_MAX - and leave the rest
+ * for the program to run on.
+ */
+#define USERSTACK_PAGES   12
+#define EXEC_ARGMAX       ((USERSTACK_PAGES - 4) * PAGE_SIZE)
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -56,6 +66,7 @@ struct addrspace {
   paddr_t as_pbase2;
   size_t as_npages2;
   paddr_t as_stackpbase;
+  paddr_t as_tstackpbase[THREAD_MAX];   /* per thread id; 0 is unused */
 #if OPT_A3
   int elf_loaded;
 #endif
@@ -95,6 +106,16 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_tstack - set up the stack for user thread TID (1 to
+ *                THREAD_MAX-1) of a multithreaded process and hand back
+ *                its initial stack pointer. The first thread uses the
+ *                stack from as_define_stack. A thread id's stack is
+ *                kept once made and reused by later threads with
+ *                that id.
+ *
+ *    as_respages - number of physical pages the address space holds,
+ *                for process listings.
  */
 
 struct addrspace *as_create(void);
@@ -111,6 +132,9 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_tstack(struct addrspace *as, unsigned tid,
+                                   vaddr_t *initstackptr);
+unsigned          as_respages(struct addrspace *as);
 
 
 /*
@@ -118,9 +142,18 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *
+ *    elfcache_forget - drop the cached image of V, if any, and with it
+ *               the cache's reference to V. For the VFS to call when
+ *               the file is removed, so it can really go away.
+ *
+ *    elfcache_purge - the same for every cached image on FS, before
+ *               it is unmounted.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void elfcache_forget(struct vnode *v);
+void elfcache_purge(struct fs *fs);
 
 
 #endif /* _ADDRSPACE_H_ */
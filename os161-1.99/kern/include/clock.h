@@ -38,8 +38,8 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once every LT_GRANULARITY usec
+ * to drive timed sleeps (see clocknap() and friends below).
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -70,8 +70,6 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
- *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
@@ -83,5 +81,48 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * clocknanosleep() suspends execution for at least the given time,
+ * rounded up to whole timer ticks, like userlevel nanosleep(2).
+ */
+void clocknanosleep(time_t secs, uint32_t nsecs);
+
+/*
+ * clock_ticks() converts a time interval to timer ticks, rounding up.
+ */
+uint64_t clock_ticks(time_t secs, uint32_t nsecs);
+
+/*
+ * clock_uptime() returns whole seconds since boot, as counted by
+ * timerclock(). Unlike gettime() it doesn't touch the clock device,
+ * so it's cheap enough to call from hardclock().
+ */
+unsigned clock_uptime(void);
+
+/*
+ * Timeouts: have timerclock() call a function after some number of
+ * timer ticks. The function is called in interrupt context, so it
+ * must not sleep; usually it just hands off to a thread, e.g. by
+ * queueing work (see workqueue.h).
+ *
+ * timeout_init - set up TO to call FUNC(ARG).
+ * timeout_add  - arm TO to fire no sooner than NTICKS (at least 1)
+ *                ticks from now. It must not already be armed.
+ * timeout_del  - disarm TO. Returns true if it was armed, in which
+ *                case FUNC won't be called; if false, it may have
+ *                fired already and FUNC may still be running.
+ */
+struct timeout {
+	uint64_t to_expire;		/* tick at which to fire */
+	bool to_armed;			/* on the timer wheel */
+	void (*to_func)(void *);
+	void *to_arg;
+	struct timeout *to_next;	/* next in the same slot */
+};
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_add(struct timeout *to, uint64_t nticks);
+bool timeout_del(struct timeout *to);
+
 
 #endif /* _CLOCK_H_ */
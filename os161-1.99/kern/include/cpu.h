@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <workqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -60,6 +61,10 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_switches;		/* Counter of context switches */
+	unsigned c_quantum_start;	/* c_hardclocks when curthread began */
+	unsigned c_rcu_gp;		/* Last RCU grace period reported */
+	bool c_intr_user;		/* Current interrupt is from user mode */
 
 	/*
 	 * Accessed by other cpus.
@@ -67,8 +72,25 @@ struct cpu {
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	uint64_t c_pass;		/* Stride virtual time of this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Migration statistics.
+	 * Protected by the runqueue lock.
+	 */
+	unsigned c_migrate_out;		/* Threads pushed to other cpus */
+	unsigned c_migrate_warm;	/* ...of which were still cache-warm */
+	unsigned c_migrate_in;		/* Threads pushed to us */
+	unsigned c_steals;		/* Threads we stole while idle */
+
+	/*
+	 * Deferred work (see workqueue.h). c_reapwork destroys this
+	 * cpu's zombies.
+	 */
+	struct workqueue c_workqueue;
+	struct work c_reapwork;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -99,12 +121,17 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_count returns the number of cpus created so far, and cpu_get
+ * returns one of them by number.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned cpunum);
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
@@ -0,0 +1,37 @@
+#ifndef _KERN_PROCSTAT_H_
+#define _KERN_PROCSTAT_H_
+
+/*
+ * Process status, as returned by the procstat system call and shown
+ * by the ps and top menu commands.
+ */
+
+#define PS_NAMELEN	16	/* including the terminating null */
+
+/* pi_state */
+#define PS_RUN		0	/* a thread is running or runnable */
+#define PS_SLEEP	1	/* all threads are asleep */
+#define PS_ZOMBIE	2	/* exited, not yet waited for */
+
+struct procinfo {
+	__i32 pi_pid;
+	__i32 pi_ppid;			/* 0 if orphaned */
+	__i32 pi_state;
+	__u32 pi_nthreads;
+	__u32 pi_cputicks;		/* user plus system, in hardclocks */
+	__u32 pi_recent;		/* thousandths of a cpu, last second */
+	__u32 pi_respages;		/* resident pages */
+	char pi_name[PS_NAMELEN];
+};
+
+/* System-wide figures that go with a process listing. */
+struct sysstat {
+	__u32 ss_uptime;		/* seconds since boot */
+	__u32 ss_ncpus;
+	__u32 ss_hz;			/* hardclocks per second */
+	__u32 ss_nprocs;		/* processes, including zombies */
+	__u32 ss_heapused;		/* kernel heap bytes in use */
+	__u32 ss_heappages;		/* pages the kernel heap holds */
+};
+
+#endif /* _KERN_PROCSTAT_H_ */
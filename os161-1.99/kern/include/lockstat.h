@@ -0,0 +1,64 @@
+/*
+ * Lock contention profiling.
+ *
+ * Built with "options lockstat" in the kernel config. When compiled
+ * in, spinlock_acquire, lock_acquire and P() record, per lock class,
+ * the number of acquisitions, how many of those had to wait, the
+ * total and longest wait, and (for spinlocks and locks) the total and
+ * longest hold time. A class is a kind of lock plus a name, so all
+ * the locks created with the same name are counted together.
+ * Spinlocks that were never given a name with spinlock_setname are
+ * classed by the address they were acquired from instead.
+ *
+ * Recording is off until turned on with the "lockstat on" menu
+ * command, so the cost while off is one load per acquire.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+#include "opt-lockstat.h"
+
+/* Kinds of lock. */
+#define LOCKSTAT_SPIN	0	/* struct spinlock */
+#define LOCKSTAT_SLEEP	1	/* struct lock */
+#define LOCKSTAT_SEM	2	/* struct semaphore (P only) */
+
+#if OPT_LOCKSTAT
+
+struct lockstat;	/* Opaque; one per class. */
+
+/* True while recording. */
+extern volatile bool lockstat_enabled;
+
+/*
+ * Functions for the lock implementations.
+ *
+ * lockstat_now      - timestamp in nanoseconds, for the calls below.
+ * lockstat_lookup   - find or make the class for KIND/NAME; if NAME
+ *                     is NULL, PC is used as the key. Never fails:
+ *                     if the table is full, an overflow class is
+ *                     returned.
+ * lockstat_acquired - count an acquisition that started at START and
+ *                     succeeded at NOW, CONTENDED if it had to wait.
+ * lockstat_released - count a hold from ACQTIME to NOW.
+ */
+uint64_t lockstat_now(void);
+struct lockstat *lockstat_lookup(int kind, const char *name, const void *pc);
+void lockstat_acquired(struct lockstat *ls, bool contended,
+		       uint64_t start, uint64_t now);
+void lockstat_released(struct lockstat *ls, uint64_t acqtime, uint64_t now);
+
+/*
+ * Menu interface.
+ *
+ * lockstat_enable - turn recording on or off.
+ * lockstat_print  - print the TOPN classes with the most total wait
+ *                   time, optionally clearing all counters after.
+ */
+void lockstat_enable(bool on);
+void lockstat_print(unsigned topn, bool reset);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
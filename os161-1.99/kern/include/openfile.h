@@ -0,0 +1,80 @@
+/*
+ * Open files and descriptor tables.
+ *
+ * An openfile is what open() makes: a vnode, the access mode, and
+ * the seek position. Descriptors that come from the same open - by
+ * fork, dup2 or spawn - share one openfile, and with it the offset.
+ * It is refcounted and closed when the last descriptor goes away.
+ *
+ * The offset is only kept, and of_lock only made, for seekable
+ * files. I/O to a device like the console doesn't use an offset, so
+ * it goes straight to the vnode without serializing on anything.
+ *
+ * A filetable maps descriptor N straight to ft_files[N]. ft_lock
+ * covers the array. filetable_get hands back a reference, so a close
+ * by another thread can't free the openfile out from under a read.
+ */
+
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	bool of_append;			/* writes go at the end */
+	struct lock *of_lock;		/* NULL if not seekable */
+	off_t of_offset;		/* protected by of_lock */
+	struct spinlock of_reflock;
+	unsigned of_refcount;		/* protected by of_reflock */
+};
+
+struct filetable {
+	struct spinlock ft_lock;
+	struct openfile *ft_files[OPEN_MAX];
+	int ft_lowfree;			/* no free descriptor below this */
+};
+
+/*
+ * Functions.
+ *
+ * openfile_open    - open PATH with open()'s FLAGS and MODE. PATH may
+ *                    be modified, as by vfs_open.
+ * openfile_incref  - take another reference.
+ * openfile_decref  - drop a reference, closing the file if it was the
+ *                    last. May sleep.
+ *
+ * filetable_create - make an empty table.
+ * filetable_destroy - close everything and free the table.
+ * filetable_copy   - for fork: make every descriptor in empty table
+ *                    TO share the openfile of the same descriptor in
+ *                    FROM.
+ * filetable_openstd - open the console as descriptors 0, 1 and 2.
+ * filetable_place  - give OF, whose reference the table takes over,
+ *                    the lowest free descriptor. EMFILE if none.
+ * filetable_install - make FD refer to OF, taking over the reference,
+ *                    and close whatever FD referred to before.
+ * filetable_get    - look up FD and return a reference to its
+ *                    openfile, which the caller must drop. EBADF if
+ *                    FD isn't open.
+ * filetable_close  - close FD. EBADF if it isn't open.
+ */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable *filetable_create(void);
+void filetable_destroy(struct filetable *ft);
+void filetable_copy(struct filetable *from, struct filetable *to);
+int filetable_openstd(struct filetable *ft);
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+void filetable_install(struct filetable *ft, int fd, struct openfile *of);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_close(struct filetable *ft, int fd);
+
+#endif /* _OPENFILE_H_ */
@@ -0,0 +1,87 @@
+/*
+ * Per-cpu event counters.
+ *
+ * A counter keeps one slot per cpu. Bumping it touches only the
+ * current cpu's slot, with interrupts off just long enough that the
+ * thread can't be preempted or migrated between the load and the
+ * store: no atomic instructions, no locks, and no sharing between
+ * cpus. Reading sums the slots without stopping anyone, so a read
+ * that races with increments is slightly stale, but each slot is a
+ * single word and is never torn.
+ *
+ * Declare counters statically with PERCPU_COUNTER:
+ *
+ *     static PERCPU_COUNTER(fork_count, "thread_fork");
+ *     ...
+ *     percpu_counter_inc(&fork_count);
+ *
+ * A counter registers itself (joins the list printed by the
+ * "counters" menu command) the first time it is bumped; call
+ * percpu_counter_register to have it listed before that.
+ *
+ * Slots are 32 bits and wrap; totals stay right as long as no one
+ * cpu counts 2^32 events between resets.
+ */
+
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+
+/* Must be at least the platform's MAXCPUS; checked in cpu_create. */
+#define PERCPU_MAXCPUS	32
+
+struct percpu_counter {
+	const char *pc_name;
+	struct percpu_counter *pc_next;		/* registered counters */
+	volatile bool pc_registered;
+	volatile unsigned pc_count[PERCPU_MAXCPUS];
+	unsigned pc_base[PERCPU_MAXCPUS];	/* pc_count at last reset */
+};
+
+#define PERCPU_COUNTER(var, name) \
+	struct percpu_counter var = { name, NULL, false, { 0 }, { 0 } }
+
+/*
+ * Functions.
+ *
+ * percpu_counter_register - add to the list of counters to print.
+ *                           Idempotent.
+ * percpu_counter_add      - add N to the current cpu's slot.
+ * percpu_counter_inc      - add 1.
+ * percpu_counter_read     - total since boot or the last reset.
+ * percpu_counter_reset    - start counting from zero again. This
+ *                           just records a baseline; a cpu's slot is
+ *                           never written by other cpus.
+ * percpu_counters_print   - print all registered counters, with a
+ *                           per-cpu breakdown, and optionally reset
+ *                           them.
+ */
+void percpu_counter_register(struct percpu_counter *pc);
+void percpu_counter_add(struct percpu_counter *pc, unsigned n);
+uint64_t percpu_counter_read(struct percpu_counter *pc);
+void percpu_counter_reset(struct percpu_counter *pc);
+void percpu_counters_print(bool reset);
+
+#ifndef PERCPU_INLINE
+#define PERCPU_INLINE INLINE
+#endif
+
+PERCPU_INLINE void
+percpu_counter_add(struct percpu_counter *pc, unsigned n)
+{
+	int spl;
+
+	if (!pc->pc_registered) {
+		percpu_counter_register(pc);
+	}
+	spl = splhigh();
+	pc->pc_count[curcpu->c_number] += n;
+	splx(spl);
+}
+
+#define percpu_counter_inc(pc)	percpu_counter_add(pc, 1)
+
+#endif /* _PERCPU_H_ */
@@ -36,20 +36,36 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <limits.h>
+#include <kern/procstat.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <workqueue.h>
 
 struct addrspace;
+struct filetable;
 struct vnode;
+struct wchan;
+struct pidEntry;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
+/*
+ * User thread bookkeeping, one per thread id, for thread_join.
+ */
+struct uthread {
+	bool ut_exited;			/* waiting to be joined */
+	bool ut_joining;		/* someone is in thread_join on it */
+	userptr_t ut_retval;		/* thread_exit's argument */
+};
+
 /*
  * Process structure.
  */
 struct proc {
 	char *p_name;			/* Name of this process */
+	char p_comm[PS_NAMELEN];	/* Program it's running, for ps */
 	struct spinlock p_lock;		/* Lock for this structure */
 	struct threadarray p_threads;	/* Threads in this process */
 
@@ -58,15 +74,32 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
-
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	struct filetable *p_files;	/* descriptors; see openfile.h */
+
+	pid_t p_pid;			/* process id, or 0 if none yet */
+	struct pidEntry *p_children;	/* children's pid entries */
+	struct wchan *p_waitchan;	/* waitpid and thread_join sleep here */
+	bool p_vforked;			/* borrowing the parent's addrspace */
+
+	/*
+	 * User threads; protected by p_lock. A thread's id is its
+	 * t_tid, and bit N of p_tidmap is set while id N is in use,
+	 * from thread_create until it has been joined. When one
+	 * thread calls _exit or dies from a fatal trap, p_exiting is
+	 * set and the others leave the next time they come through
+	 * the kernel; the last one out does the actual exit.
+	 */
+	struct uthread p_uthreads[THREAD_MAX];
+	uint32_t p_tidmap;		/* thread ids in use */
+	unsigned p_nuthreads;		/* user threads not yet gone */
+	volatile bool p_exiting;	/* all threads are to leave */
+	int p_exitstatus;		/* wait status, once exiting */
+
+	/* Resource usage; protected by p_lock */
+	struct usage p_usage;		/* of threads that have exited */
+	struct usage p_cusage;		/* of children that have been reaped */
+
+	struct work p_destroywork;	/* for proc_destroy_deferred */
 
 	/* add more material here as needed */
 };
@@ -88,12 +121,37 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/*
+ * Have the current cpu's work queue worker destroy a process later,
+ * so an exiting thread doesn't do the teardown on its way out. The
+ * process must have no threads left.
+ */
+void proc_destroy_deferred(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Set the scheduling class and share of every thread in a process
+ * (see thread_setshare). New threads inherit it from their creator.
+ */
+int proc_setshare(struct proc *proc, int schedclass, unsigned tickets);
+
+/*
+ * Get a process's resource usage so far: that of its exited threads
+ * plus its live ones. Doesn't include children.
+ */
+void proc_getusage(struct proc *proc, struct usage *u);
+
+/*
+ * Set the command name ps shows for a process to the last component
+ * of PATH, truncated to fit.
+ */
+void proc_setcomm(struct proc *proc, const char *path);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -0,0 +1,73 @@
+/*
+ * Read-copy-update.
+ *
+ * For data that is read far more often than it changes. Readers
+ * take no locks: they bracket their accesses with rcu_read_lock and
+ * rcu_read_unlock, and pick up shared pointers with rcu_dereference.
+ * Updaters (serialized among themselves however they like) publish
+ * a new version with rcu_assign_pointer, then hand the old version to
+ * call_rcu, which frees it once every reader that could have seen it
+ * has finished.
+ *
+ * "Finished" is detected with quiescent states: a CPU that context
+ * switches, or takes a hardclock while not in a read section, or is
+ * idle, can't still be inside a read section that started earlier.
+ * Once every CPU has passed one since an object was retired, it can
+ * be freed. Callbacks run in the "rcu" kernel thread.
+ *
+ * Read sections must not sleep or yield (that is asserted), and
+ * hardclock won't preempt a thread inside one. They may nest.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include <current.h>
+#include <thread.h>
+
+/*
+ * Embed one of these in anything to be freed through call_rcu.
+ */
+struct rcu_head {
+	struct rcu_head *rh_next;
+	void (*rh_func)(struct rcu_head *);
+};
+
+/*
+ * Read side.
+ */
+#define rcu_read_lock()		((void)curthread->t_rcu_nest++)
+#define rcu_read_unlock() \
+	(KASSERT(curthread->t_rcu_nest > 0), (void)curthread->t_rcu_nest--)
+
+/*
+ * Publishing and reading shared pointers. The compiler barrier keeps
+ * the stores that fill in the new object ahead of the one that
+ * publishes it. (sys161 doesn't reorder memory operations, so that's
+ * all that's needed.)
+ */
+#define rcu_assign_pointer(p, v) \
+	do { __asm volatile("" ::: "memory"); (p) = (v); } while (0)
+#define rcu_dereference(p)	(*(volatile __typeof__(p) *)&(p))
+
+/*
+ * Update side.
+ *
+ * call_rcu        - call FUNC(HEAD) once all current readers are done.
+ *                   May be called from any context, including inside
+ *                   a read section or with a spinlock held.
+ * synchronize_rcu - sleep until all current readers are done.
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+void synchronize_rcu(void);
+
+/*
+ * Hooks for the thread system.
+ *
+ * rcu_bootstrap   - start up; call after the secondary CPUs are up.
+ * rcu_quiescent   - the current CPU is not in a read section.
+ */
+void rcu_bootstrap(void);
+void rcu_quiescent(void);
+
+#endif /* _RCU_H_ */
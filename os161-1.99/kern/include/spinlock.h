@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -50,6 +51,14 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * By default a spinlock is test-and-test-and-set, which is cheapest
+ * when uncontended but unfair: nothing stops one CPU from winning
+ * every time. A lock can instead be made a FIFO ticket lock, by
+ * initializing it with spinlock_init_fair or SPINLOCK_FAIR_INITIALIZER.
+ * Then lk_next is the next ticket to hand out, lk_lock is the ticket
+ * now being served, and CPUs get the lock in the order they asked.
+ * Everything else about the lock, including the API, is the same.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
@@ -57,26 +66,50 @@
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	volatile spinlock_data_t lk_next; /* Next ticket (fair locks). */
+	bool lk_fair;			/* True for a ticket lock. */
+#if OPT_LOCKSTAT
+	const char *lk_name;		/* Class name for lockstat. */
+	struct lockstat *lk_stat;	/* Class of the current hold. */
+	uint64_t lk_acqtime;		/* When acquired, if recording. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * The NAMED form gives the lock a lockstat class name; the FAIR form
+ * makes a named ticket lock.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER_(name, fair) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, SPINLOCK_DATA_INITIALIZER, \
+	  fair, name, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER_(name, fair) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, SPINLOCK_DATA_INITIALIZER, fair }
+#endif
+#define SPINLOCK_NAMED_INITIALIZER(name) SPINLOCK_INITIALIZER_(name, false)
+#define SPINLOCK_FAIR_INITIALIZER(name)	 SPINLOCK_INITIALIZER_(name, true)
+#define SPINLOCK_INITIALIZER	SPINLOCK_NAMED_INITIALIZER(NULL)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_fair	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * setname	Name the lock for lockstat. NAME is not copied and must
+ *		live as long as the lock. Does nothing without lockstat.
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_fair(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -84,5 +117,7 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+void spinlock_setname(struct spinlock *lk, const char *name);
+
 
 #endif /* _SPINLOCK_H_ */
@@ -48,6 +48,9 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+#if OPT_LOCKSTAT
+        struct lockstat *sem_stat;
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -71,16 +74,46 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins for a
+ * while as long as the owner is running on another CPU, on the theory
+ * that the owner will drop it soon, and only sleeps on lk_wchan if the
+ * owner blocks or the spin budget runs out. lk_owner is the thread
+ * holding the lock; lk_holder is the CPU it acquired it on, which is
+ * what the spinner watches (it is never freed, unlike the thread).
+ *
+ * Locks also do priority inheritance: while threads are asleep on a
+ * lock, its owner runs with the largest effective share (see
+ * thread.h) among them, and that passes on down a chain of owners
+ * that are themselves asleep on other locks. lk_piwaiters lists the
+ * sleepers; lk_piowner is the owner as far as inheritance goes, set
+ * only while there are sleepers, and lk_pinext links the lock into
+ * that owner's t_pilocks. These are protected by both lk_spinlock
+ * and the global pi lock in synch.c, so either is enough to read
+ * them.
+ *
+ * The counters are protected by lk_spinlock.
  */
 struct lock {
         char *lk_name;
         volatile bool locked;
         struct wchan *lk_wchan;
         struct spinlock lk_spinlock;
-        struct cpu *lk_holder;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
-
+        struct thread *volatile lk_owner;
+        struct cpu *volatile lk_holder;
+
+        struct thread *lk_piwaiters;    /* sleepers, via t_piwaitnext */
+        struct thread *lk_piowner;      /* owner they donate to */
+        struct lock *lk_pinext;         /* next in lk_piowner's t_pilocks */
+
+        unsigned lk_acquires;           /* total acquisitions */
+        unsigned lk_contended;          /* ...that found the lock held */
+        unsigned lk_spinwins;           /* ...and got it by spinning */
+        unsigned lk_sleeps;             /* times a waiter went to sleep */
+#if OPT_LOCKSTAT
+        struct lockstat *lk_stat;
+        uint64_t lk_acqtime;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -101,6 +134,24 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * Adaptive spinning controls.
+ *    lock_spin_tune - set the number of polls a contended acquire
+ *                   spends waiting for a running owner before it sleeps
+ *                   (0 disables spinning).
+ *    lock_spin_stats - print, and optionally reset, the system-wide
+ *                   contention and spin counters.
+ *    lock_print_stats - print one lock's own counters.
+ *
+ * Priority inheritance can be switched off (for testing) with
+ * lock_pi_enable. Threads already asleep keep their donations until
+ * they get the lock.
+ */
+void lock_spin_tune(unsigned maxspins);
+void lock_spin_stats(bool reset);
+void lock_print_stats(struct lock *lock);
+void lock_pi_enable(bool on);
+
 
 /*
  * Condition variable.
@@ -146,4 +197,55 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers queue
+ * behind it. To keep readers from starving under a steady stream of
+ * writers, a writer that releases the lock while readers are queued
+ * hands it directly to all of them as a batch; the next writer goes
+ * after that batch drains.
+ *
+ * rw_readers is the count of readers holding the lock; a read acquire
+ * with no writer present or waiting just bumps it under rw_spinlock.
+ * rw_rgen advances on each hand-off so a woken reader can tell its
+ * batch was admitted.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rw_name;
+        struct spinlock rw_spinlock;
+        struct wchan *rw_rwchan;                /* waiting readers */
+        struct wchan *rw_wwchan;                /* waiting writers */
+        volatile unsigned rw_readers;
+        struct thread *volatile rw_writer;
+        volatile unsigned rw_waitreaders;
+        volatile unsigned rw_waitwriters;
+        volatile unsigned rw_rgen;
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Other readers may
+ *                           hold it at the same time.
+ *    rwlock_release_read  - Drop a read hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Drop the exclusive hold. Only the writer
+ *                           holding the lock may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread is the
+ *                           writer. (Readers are not tracked.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -34,9 +34,12 @@
 #if OPT_A2
 #include <spinlock.h>
 #include <synch.h>
+#include <thread.h>
+#include <kern/procstat.h>
 #endif
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace;
 
 
 
@@ -67,35 +70,84 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
+int sys_futex_wait(userptr_t uaddr, int val);
+int sys_futex_wake(userptr_t uaddr, int n, int *retval);
+
+/* Set up the futex wait table. */
+void futex_bootstrap(void);
+
+/* Wake every futex_wait sleeper in AS, so it can see its process exiting. */
+void futex_wakeall(struct addrspace *as);
 
 #ifdef UW
+int sys_open(userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, size_t nbytes, int *retval);
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_close(int fdesc);
+int sys_dup2(int oldfd, int newfd, int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+              pid_t *retval);
+int sys_getrusage(int who, userptr_t rusage);
+int sys_setshare(pid_t pid, int tickets);
 #if OPT_A2
 struct pidEntry{
   struct proc *thisProc;
   int pid;
-  struct proc *child;
   struct proc *parent;
   int exited;
-  int code;
-  struct cv *e_cv;
-  struct lock *e_lk;
+  int code;                     /* wait status, once exited */
+  int vforking;                 /* parent waits in vfork until clear */
+  int held;                     /* a parent thread is reaping it or in
+                                   vfork on it; other waiters keep off */
+  struct usage usage;           /* rusage incl. children, once exited */
+  char comm[PS_NAMELEN];        /* its p_comm, once exited */
+  struct pidEntry *e_sibnext;   /* parent's p_children */
+  struct pidEntry *e_sibprev;
 };
 struct pidTable{
   struct spinlock p_spinlock;
-  struct pidEntry **table;
+  struct pidEntry **table;      /* indexed by pid */
+  uint32_t *map;                /* bit set for each pid in use */
+  pid_t hint;                   /* start of the next free-pid search */
   int numprocs;
-  
 };
 struct pidTable *PID_TABLE;
 struct pidTable *create_pidTable(void);
+/* These take the table lock themselves. */
 int add_pidEntry(struct pidTable *ptable, struct proc *target, struct proc *parent, pid_t *retval);
 void remove_pidEntry(struct pidTable *ptable, int pid);
+void exit_pidEntry(struct pidTable *ptable, struct proc *p, int status);
+bool vfork_release(struct proc *p);
+/*
+ * Exit the current process with wait status STATUS: the caller
+ * leaves at once and the other threads as they next pass through
+ * the kernel. Does not return.
+ */
+void exit_curproc(int status);
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t progname, userptr_t args);
+int sys_spawn(userptr_t progname, userptr_t args, userptr_t fds, int nfds,
+              pid_t *retval);
+int sys_thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+                      int *retval);
+void sys_thread_exit(userptr_t retval);
+int sys_thread_join(int tid, userptr_t retval);
+int sys_procstat(userptr_t buf, int n, userptr_t sysstat, int *retval);
+/*
+ * Fill BUF with up to MAX process listings, in pid order, starting
+ * at pid *NEXT, and advance *NEXT. Returns how many were filled in;
+ * 0 means the table is done. Used by procstat and the ps and top
+ * menu commands.
+ */
+unsigned procstat_collect(pid_t *next, struct procinfo *buf, unsigned max);
+/* The system-wide figures that go with a listing. */
+void procstat_system(struct sysstat *ss);
 #endif
 
 #endif // UW
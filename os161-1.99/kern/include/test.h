@@ -60,6 +60,13 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int rwperftest(int, char **);
+int spinbenchtest(int, char **);
+int sharetest(int, char **);
+int pitest(int, char **);
+int rcutest(int, char **);
+int wqtest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -41,6 +41,8 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
+struct addrspace;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +58,19 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Scheduling classes. SCHED_RR threads are run round-robin off the
+ * per-cpu run queue. SCHED_STRIDE threads get cpu time in proportion
+ * to their tickets (stride scheduling); see schedule() in thread.c.
+ * Whenever any stride-class thread exists, round-robin threads
+ * compete with them as if they held STRIDE_DEFAULT_TICKETS.
+ */
+#define SCHED_RR	0
+#define SCHED_STRIDE	1
+
+#define STRIDE_DEFAULT_TICKETS	100
+#define STRIDE_MAX_TICKETS	10000
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -64,6 +79,20 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * Resource usage, kept per thread and rolled up into the process for
+ * getrusage. CPU time is sampled: each hardclock is charged to the
+ * thread it interrupts, as user or system time according to which
+ * mode it interrupted.
+ */
+struct usage {
+	uint64_t u_uticks;		/* hardclocks in user mode */
+	uint64_t u_sticks;		/* hardclocks in the kernel */
+	unsigned u_minflt;		/* page faults */
+	unsigned u_nvcsw;		/* voluntary context switches */
+	unsigned u_nivcsw;		/* preemptions */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -82,7 +111,60 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	bool t_pinned;			/* Never moved off t_cpu */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_tid;			/* User thread id within t_proc */
+	struct addrspace *t_loadas;	/* Used instead of t_proc's if set */
+
+	/*
+	 * Cache affinity hints for migration. t_lastrun is the value
+	 * of t_lastcpu->c_hardclocks when the thread was last switched
+	 * out; t_lastcpu is NULL if the thread has never run.
+	 */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastrun;		/* When it stopped running there */
+
+	/*
+	 * Proportional-share scheduling state. t_pass advances by
+	 * t_stride for every hardclock the thread runs; the runnable
+	 * thread with the lowest pass runs next.
+	 */
+	int t_schedclass;		/* SCHED_RR or SCHED_STRIDE */
+	unsigned t_tickets;		/* Share of the cpu */
+	uint32_t t_stride;		/* STRIDE1 / t_tickets */
+	uint64_t t_pass;		/* Virtual time consumed */
+
+	/*
+	 * Priority inheritance on locks (see synch.c). A thread's
+	 * effective share is the larger of t_tickets and t_inherit,
+	 * the largest effective share among the threads asleep on
+	 * locks it holds. Protected by the synch.c pi lock.
+	 */
+	unsigned t_inherit;		/* Donated tickets, or 0 */
+	struct lock *t_waitlock;	/* Lock we're asleep on */
+	struct thread *t_piwaitnext;	/* Next waiter on t_waitlock */
+	struct lock *t_pilocks;		/* Held locks that have waiters */
+
+	/* Depth of rcu_read_lock nesting (see rcu.h) */
+	unsigned t_rcu_nest;
+
+	/*
+	 * Resource usage. Updated only by the thread itself (or by
+	 * hardclock while it's running); others may read it without
+	 * locking and see slightly stale values.
+	 */
+	struct usage t_usage;
+	bool t_preempting;		/* Switch is a preemption */
+
+	/*
+	 * Recent cpu use, for ps: hardclocks that found the thread
+	 * running during second t_cpuwin of uptime, and during the
+	 * second before that. Written only by hardclock on the
+	 * thread's cpu; see thread_recentcpu.
+	 */
+	unsigned t_cpuwin;
+	unsigned t_cpunow;
+	unsigned t_cpuprev;
 
 	/*
 	 * Interrupt state fields.
@@ -144,6 +226,26 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread starts on cpu CPUNUM and is
+ * pinned there: migration and idle stealing leave it alone. For
+ * per-cpu service threads.
+ */
+int thread_fork_pinned(const char *name, struct proc *proc,
+                       unsigned cpunum,
+                       void (*func)(void *, unsigned long),
+                       void *data1, unsigned long data2);
+
+/*
+ * Like thread_fork, but the new thread starts on whichever cpu has
+ * the least to do, so that it can run in parallel with its creator
+ * right away instead of waiting to be migrated or stolen. For the
+ * threads of parallel user programs.
+ */
+int thread_fork_spread(const char *name, struct proc *proc,
+                       void (*func)(void *, unsigned long),
+                       void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -157,16 +259,64 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Like thread_yield, but for when the thread is being made to yield
+ * (from the timer interrupt); counted as an involuntary switch.
+ */
+void thread_preempt(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for one hardclock's worth of cpu time,
+ * as user time if USER (the tick interrupted user mode). Called from
+ * the timer interrupt.
+ */
+void thread_account_tick(bool user);
+
+/* Add the counts in FROM to TO. */
+void usage_add(struct usage *to, const struct usage *from);
+
+/*
+ * Hardclocks that thread T was charged for during the last whole
+ * second. Reads T's counters unlocked, so may be a little off.
+ */
+unsigned thread_recentcpu(struct thread *t);
+
+/*
+ * Set the scheduling class and ticket count of a thread. TICKETS is
+ * ignored for SCHED_RR. Threads created with thread_fork inherit the
+ * class and tickets of the thread that created them. Returns EINVAL
+ * for a bad class or ticket count.
+ */
+int thread_setshare(struct thread *t, int schedclass, unsigned tickets);
+
+/*
+ * Set the tickets a thread has inherited through a lock (0 for none).
+ * Its stride follows the larger of these and its own tickets.
+ */
+void thread_inherit(struct thread *t, unsigned tickets);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Migration policy knobs and statistics.
+ *
+ * thread_migration_tune sets the number of hardclocks a thread must
+ * have been off-cpu before it is considered cache-cold, and how many
+ * threads over its fair share a run queue must be before anything is
+ * pushed elsewhere. thread_migration_stats prints the per-cpu
+ * migration counters, optionally resetting them.
+ */
+void thread_migration_tune(unsigned coldticks, unsigned hysteresis);
+void thread_migration_stats(bool reset);
+
 
 #endif /* _THREAD_H_ */
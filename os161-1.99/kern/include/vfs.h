@@ -55,6 +55,8 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_clearcurdir - change current directory of current thread to "none"
  *    vfs_getcurdir - retrieve vnode of current directory of current thread
  *    vfs_sync      - force all dirty buffers to disk
+ *    vfs_syncer_start - start syncing every VFS_SYNC_SECONDS from
+ *                    the work queue
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
  *    vfs_getdevname - get mounted device name for the filesystem passed in
  */
@@ -63,6 +65,7 @@ int vfs_setcurdir(struct vnode *dir);
 int vfs_clearcurdir(void);
 int vfs_getcurdir(struct vnode **retdir);
 int vfs_sync(void);
+void vfs_syncer_start(void);
 int vfs_getroot(const char *devname, struct vnode **result);
 const char *vfs_getdevname(struct fs *fs);
 
@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <spinlock.h>
 
 struct uio;
 struct stat;
@@ -50,10 +51,16 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * vn_version changes every time the file is written or truncated, so
+ * code that caches something derived from the file's contents can
+ * tell when it has gone stale.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	int vn_opencount;
+	struct spinlock vn_versionlock;	/* Serializes vn_version bumps */
+	volatile unsigned vn_version;	/* Bumped by VOP_WRITE/TRUNCATE */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -248,14 +255,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -274,6 +281,14 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * Write and truncate, with vn_version bookkeeping (handled above
+ * filesystem level). The version is bumped after the operation, so a
+ * cache filled while a write was in progress is seen to be stale.
+ */
+int vnode_write(struct vnode *, struct uio *);
+int vnode_truncate(struct vnode *, off_t pos);
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
@@ -0,0 +1,94 @@
+/*
+ * Deferred work.
+ *
+ * Each cpu has a work queue and a worker thread pinned to that cpu.
+ * Code that shouldn't do something expensive inline - because it
+ * holds locks, has interrupts off, or is on a latency-critical path -
+ * can package it as a struct work and queue it; the worker runs it
+ * later in an ordinary thread context, where it may sleep.
+ *
+ * Items queued on one cpu run in the order they were queued, one at
+ * a time. A work item is queued at most once at a time: queueing one
+ * that is already pending does nothing. It stops being pending just
+ * before its function is called, so the function may requeue it.
+ *
+ * Work can also be delayed by some number of timer ticks (see
+ * clock_ticks in clock.h); it then goes on the queue of the cpu it
+ * was submitted from when the timer fires.
+ *
+ * struct work is usually embedded in something longer-lived. It must
+ * not be freed or reused while pending.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <spinlock.h>
+#include <clock.h>
+
+struct wchan;
+
+struct work {
+	void (*wk_func)(void *);
+	void *wk_data;
+	volatile spinlock_data_t wk_pending;	/* queued or timer armed */
+	unsigned wk_cpu;			/* queue for delayed work */
+	uint64_t wk_queued;			/* when queued, in nsecs */
+	struct timeout wk_timeout;
+	struct work *wk_next;
+};
+
+/*
+ * One cpu's queue. This lives in struct cpu; wq_lock protects all
+ * of it.
+ */
+struct workqueue {
+	struct spinlock wq_lock;
+	struct work *wq_head;
+	struct work **wq_tailp;
+	struct wchan *wq_wchan;		/* worker sleeps here */
+
+	unsigned wq_depth;		/* items queued now */
+	unsigned wq_maxdepth;		/* high-water mark */
+	unsigned wq_queued;		/* items ever queued */
+	unsigned wq_run;		/* items run */
+	uint64_t wq_latsum;		/* total queue-to-start time */
+	uint64_t wq_latmax;		/* worst queue-to-start time */
+};
+
+/*
+ * Functions.
+ *
+ * work_init             - set up WK to call FUNC(DATA).
+ * workqueue_add         - queue WK on the current cpu. Returns false
+ *                         if it was already pending. Callable from
+ *                         any context that may take a spinlock,
+ *                         including interrupt handlers.
+ * workqueue_add_on      - queue WK on cpu CPUNUM.
+ * workqueue_add_delayed - queue WK on the current cpu NTICKS timer
+ *                         ticks from now.
+ * workqueue_cancel      - unqueue WK if it is pending but not yet
+ *                         running. Returns true if it was. Can miss
+ *                         delayed work whose timer is firing right
+ *                         then.
+ * workqueue_flush       - wait until everything queued (not delayed)
+ *                         on any cpu before the call has run.
+ * workqueue_stats       - print per-cpu queue statistics, and
+ *                         optionally reset them.
+ *
+ * workqueue_init        - set up a cpu's queue; called by cpu_create.
+ * workqueue_bootstrap   - start the workers; call after the secondary
+ *                         cpus are up. Work queued earlier waits.
+ */
+void work_init(struct work *wk, void (*func)(void *), void *data);
+bool workqueue_add(struct work *wk);
+bool workqueue_add_on(unsigned cpunum, struct work *wk);
+bool workqueue_add_delayed(struct work *wk, uint64_t nticks);
+bool workqueue_cancel(struct work *wk);
+void workqueue_flush(void);
+void workqueue_stats(bool reset);
+
+void workqueue_init(struct workqueue *wq);
+void workqueue_bootstrap(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -49,6 +49,8 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <wchan.h>
+#include <openfile.h>
 #include <kern/fcntl.h> 
 #include "opt-A2.h" 
 
@@ -74,7 +76,7 @@ static struct semaphore *proc_count_mutex;
 struct semaphore *no_proc_sem;   
 #endif  // UW
 
-
+static void proc_destroy_work(void *data);
 
 /*
  * Create a proc structure.
@@ -97,6 +99,8 @@ proc_create(const char *name)
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+	spinlock_setname(&proc->p_lock, "proc");
+	proc_setcomm(proc, name);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -104,13 +108,55 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	/* Not in the pid table yet */
+	proc->p_pid = 0;
+	proc->p_children = NULL;
+	proc->p_vforked = false;
+	bzero(proc->p_uthreads, sizeof(proc->p_uthreads));
+	proc->p_tidmap = 0;
+	proc->p_nuthreads = 0;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+	work_init(&proc->p_destroywork, proc_destroy_work, proc);
+	proc->p_waitchan = wchan_create(proc->p_name);
+	if (proc->p_waitchan == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
+	/* no descriptors open yet */
+	proc->p_files = filetable_create();
+	if (proc->p_files == NULL) {
+		wchan_destroy(proc->p_waitchan);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 
 	return proc;
 }
 
+/*
+ * Work function for proc_destroy_deferred. The worker has already let
+ * go of the work item, so it's fine for proc_destroy to free it.
+ */
+static
+void
+proc_destroy_work(void *data)
+{
+	proc_destroy(data);
+}
+
+void
+proc_destroy_deferred(struct proc *proc)
+{
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	workqueue_add(&proc->p_destroywork);
+}
+
 /*
  * Destroy a proc structure.
  */
@@ -128,6 +174,8 @@ proc_destroy(struct proc *proc)
 
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
+	/* exit_pidEntry (or fork_abort) has let go of any children */
+	KASSERT(proc->p_children == NULL);
 
 	/*
 	 * We don't take p_lock in here because we must have the only
@@ -140,6 +188,8 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	filetable_destroy(proc->p_files);
+	proc->p_files = NULL;
 
 
 #ifndef UW  // in the UW version, space destruction occurs in sys_exit, not here
@@ -162,14 +212,9 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
-	}
-#endif // UW
-
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
+	wchan_destroy(proc->p_waitchan);
 
 	kfree(proc->p_name);
 	kfree(proc);
@@ -214,10 +259,11 @@ proc_bootstrap(void)
   }
 #ifdef OPT_A2
   PID_TABLE = create_pidTable();
+  if (PID_TABLE == NULL) {
+    panic("could not create pid table\n");
+  }
   pid_t retval;
-  spinlock_acquire(&PID_TABLE->p_spinlock);
   int err = add_pidEntry(PID_TABLE, kproc, NULL, &retval);
-  spinlock_release(&PID_TABLE->p_spinlock);
   if (err) {
     panic("pidTable addition in proc_bootstrap failed: %s\n", strerror(err));
   }
@@ -236,29 +282,25 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
-	}
-	kfree(console_path);
-#endif // UW
-	  
+	/*
+	 * No descriptors: runprogram opens the console on 0, 1 and 2,
+	 * and fork and spawn pass along the parent's.
+	 */
+
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
 
+	/* the one thread about to be started in it; fork may renumber it */
+	proc->p_tidmap = 1;
+	proc->p_nuthreads = 1;
+
 	/* VFS fields */
 
 #ifdef UW
@@ -330,6 +372,7 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			usage_add(&proc->p_usage, &t->t_usage);
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -340,6 +383,59 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+void
+proc_setcomm(struct proc *proc, const char *path)
+{
+	const char *name;
+	size_t len;
+
+	name = strrchr(path, '/');
+	name = (name != NULL && name[1] != 0) ? name + 1 : path;
+	len = strlen(name);
+	if (len >= PS_NAMELEN) {
+		len = PS_NAMELEN - 1;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	memcpy(proc->p_comm, name, len);
+	proc->p_comm[len] = 0;
+	spinlock_release(&proc->p_lock);
+}
+
+void
+proc_getusage(struct proc *proc, struct usage *u)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	*u = proc->p_usage;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		usage_add(u, &threadarray_get(&proc->p_threads, i)->t_usage);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Set the scheduling class and share of all of a process's threads.
+ */
+int
+proc_setshare(struct proc *proc, int schedclass, unsigned tickets)
+{
+	unsigned i, num;
+	int result;
+
+	result = 0;
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num && result == 0; i++) {
+		result = thread_setshare(threadarray_get(&proc->p_threads, i),
+					 schedclass, tickets);
+	}
+	spinlock_release(&proc->p_lock);
+	return result;
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
@@ -357,6 +453,10 @@ curproc_getas(void)
 		return NULL;
 	}
 #endif
+	/* a thread loading a new image works in it alone */
+	if (curthread->t_loadas != NULL) {
+		return curthread->t_loadas;
+	}
 
 	spinlock_acquire(&curproc->p_lock);
 	as = curproc->p_addrspace;
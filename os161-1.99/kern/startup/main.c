@@ -47,6 +47,8 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <rcu.h>
+#include <workqueue.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -124,7 +126,11 @@ boot(void)
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
+	rcu_bootstrap();
+	workqueue_bootstrap();
+	vfs_syncer_start();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
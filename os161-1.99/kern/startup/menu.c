@@ -42,9 +42,16 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <percpu.h>
+#include <workqueue.h>
+#include <kern/procstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
+#if OPT_LOCKSTAT
+#include <lockstat.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -416,6 +423,245 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for printing, resetting, or tuning thread migration.
+ */
+static
+int
+cmd_migstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_migration_stats(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_migration_stats(true);
+		return 0;
+	}
+	if (nargs == 3) {
+		thread_migration_tune(atoi(args[1]), atoi(args[2]));
+		return 0;
+	}
+	kprintf("Usage: mig [reset | coldticks hysteresis]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for printing, resetting, or tuning adaptive lock spinning.
+ */
+static
+int
+cmd_lockspin(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lock_spin_stats(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lock_spin_stats(true);
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "spin")) {
+		lock_spin_tune(atoi(args[2]));
+		return 0;
+	}
+	kprintf("Usage: lk [reset | spin maxpolls]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for dumping (and optionally resetting) the per-cpu counters.
+ */
+static
+int
+cmd_counters(int nargs, char **args)
+{
+	if (nargs == 1) {
+		percpu_counters_print(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		percpu_counters_print(true);
+		return 0;
+	}
+	kprintf("Usage: counters [reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for printing (and optionally resetting) work queue stats.
+ */
+static
+int
+cmd_wqstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		workqueue_stats(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		workqueue_stats(true);
+		return 0;
+	}
+	kprintf("Usage: wq [reset]\n");
+	return EINVAL;
+}
+
+#if OPT_A2
+/*
+ * Process listings. ps shows every process; top shows the ones that
+ * used the most cpu over the last second. Recent use comes from
+ * hardclock sampling, so it's only as fine-grained as HZ.
+ */
+
+/* processes fetched per procstat_collect call */
+#define PS_CHUNK 16
+/* most processes top will show */
+#define TOP_MAX 20
+
+/*
+ * Too big for a 4k kernel stack, so static. The menu runs one command
+ * at a time, so ps and top can share them without a lock.
+ */
+static struct procinfo ps_chunk[PS_CHUNK];
+static struct procinfo top_best[TOP_MAX];
+
+static
+void
+ps_header(void)
+{
+	struct sysstat ss;
+
+	procstat_system(&ss);
+	kprintf("up %u sec, %u cpus, %u procs, kernel heap %u bytes "
+		"in %u pages\n", ss.ss_uptime, ss.ss_ncpus, ss.ss_nprocs,
+		ss.ss_heapused, ss.ss_heappages);
+	kprintf("  PID  PPID S THR      CPU  %%CPU  RES NAME\n");
+}
+
+static
+void
+ps_print(const struct procinfo *pi)
+{
+	static const char states[] = "RSZ";
+
+	kprintf("%5d %5d %c %3u %5u.%02u %3u.%u %4u %s\n",
+		pi->pi_pid, pi->pi_ppid, states[pi->pi_state],
+		pi->pi_nthreads, pi->pi_cputicks / HZ,
+		(pi->pi_cputicks % HZ) * 100 / HZ,
+		pi->pi_recent / 10, pi->pi_recent % 10,
+		pi->pi_respages, pi->pi_name);
+}
+
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	struct procinfo *chunk = ps_chunk;
+	unsigned i, n;
+	pid_t next;
+
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: ps\n");
+		return EINVAL;
+	}
+
+	ps_header();
+	next = PID_MIN;
+	while ((n = procstat_collect(&next, chunk, PS_CHUNK)) > 0) {
+		for (i=0; i<n; i++) {
+			ps_print(&chunk[i]);
+		}
+	}
+	return 0;
+}
+
+static
+int
+cmd_top(int nargs, char **args)
+{
+	struct procinfo *chunk = ps_chunk;
+	struct procinfo *best = top_best;
+	unsigned i, j, n, nbest, max;
+	pid_t next;
+
+	max = 10;
+	if (nargs == 2 && atoi(args[1]) > 0) {
+		max = atoi(args[1]);
+		if (max > TOP_MAX) {
+			max = TOP_MAX;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: top [N]\n");
+		return EINVAL;
+	}
+
+	/* keep best[] sorted by recent use, busiest first */
+	nbest = 0;
+	next = PID_MIN;
+	while ((n = procstat_collect(&next, chunk, PS_CHUNK)) > 0) {
+		for (i=0; i<n; i++) {
+			j = nbest < max ? nbest++ : max;
+			while (j > 0 &&
+			       best[j-1].pi_recent < chunk[i].pi_recent) {
+				if (j < max) {
+					best[j] = best[j-1];
+				}
+				j--;
+			}
+			if (j < max) {
+				best[j] = chunk[i];
+			}
+		}
+	}
+
+	ps_header();
+	for (i=0; i<nbest; i++) {
+		ps_print(&best[i]);
+	}
+	return 0;
+}
+#endif
+
+#if OPT_LOCKSTAT
+/*
+ * Command for the lock contention profiler.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_print(10, false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		lockstat_enable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		lockstat_enable(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_print(10, true);
+		return 0;
+	}
+	if (nargs == 2 && atoi(args[1]) > 0) {
+		lockstat_print(atoi(args[1]), false);
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "reset") && atoi(args[2]) > 0) {
+		lockstat_print(atoi(args[2]), true);
+		return 0;
+	}
+	kprintf("Usage: lockstat [on | off | N | reset [N]]\n");
+	return EINVAL;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -485,6 +731,13 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test          (1)     ",
+	"[sy5] RW lock throughput    (1)     ",
+	"[sy6] Spinlock fairness bench       ",
+	"[sch] Stride share test             ",
+	"[pi]  Priority inheritance test     ",
+	"[rcu] RCU read-side benchmark       ",
+	"[wqt] Work queue test               ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -525,6 +778,17 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[mig] Thread migration stats        ",
+	"[lk] Lock contention/spin stats     ",
+	"[counters] Per-cpu event counters   ",
+	"[wq] Work queue stats               ",
+#if OPT_A2
+	"[ps] Process list                   ",
+	"[top] Busiest processes             ",
+#endif
+#if OPT_LOCKSTAT
+	"[lockstat] Lock profiler            ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -582,6 +846,17 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "mig",	cmd_migstats },
+	{ "lk",		cmd_lockspin },
+	{ "counters",	cmd_counters },
+	{ "wq",		cmd_wqstats },
+#if OPT_A2
+	{ "ps",		cmd_ps },
+	{ "top",	cmd_top },
+#endif
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -599,6 +874,17 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	rwperftest },
+	{ "sy6",	spinbenchtest },
+
+	/* scheduler tests */
+	{ "sch",	sharetest },
+	{ "pi",		pitest },
+
+	/* deferred work tests */
+	{ "rcu",	rcutest },
+	{ "wqt",	wqtest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -1,60 +1,207 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
 #include <syscall.h>
+#include <synch.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <openfile.h>
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
- *
- * You will need to improve this implementation
+ * File system calls. Descriptors index curproc's file table; see
+ * openfile.h.
  */
 
 int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
 {
+  struct openfile *of;
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if (!result) {
+    result = openfile_open(path, flags, mode, &of);
+  }
+  kfree(path);
+  if (result) {
+    return result;
+  }
+
+  result = filetable_place(curproc->p_files, of, retval);
+  if (result) {
+    openfile_decref(of);
+  }
+  return result;
+}
+
+/*
+ * read and write. For seekable files the offset lock is held across
+ * the transfer, so that reads and writes through a shared openfile
+ * each see and advance the offset atomically; others go straight to
+ * the vnode.
+ */
+static int
+file_rw(int fdesc, userptr_t ubuf, size_t nbytes, enum uio_rw rw,
+        int *retval)
+{
+  struct openfile *of;
   struct iovec iov;
   struct uio u;
-  int res;
+  struct stat st;
+  int result;
 
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
+  result = filetable_get(curproc->p_files, fdesc, &of);
+  if (result) {
+    return result;
+  }
+  if (of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+    openfile_decref(of);
+    return EBADF;
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
 
   /* set up a uio structure to refer to the user program's buffer (ubuf) */
   iov.iov_ubase = ubuf;
   iov.iov_len = nbytes;
   u.uio_iov = &iov;
   u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
+  u.uio_offset = 0;
   u.uio_resid = nbytes;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
-  u.uio_space = curproc->p_addrspace;
+  u.uio_rw = rw;
+  u.uio_space = curproc_getas();
+
+  if (of->of_lock == NULL) {
+    result = (rw == UIO_READ) ? VOP_READ(of->of_vnode, &u) :
+      VOP_WRITE(of->of_vnode, &u);
+  }
+  else {
+    lock_acquire(of->of_lock);
+    result = 0;
+    if (rw == UIO_WRITE && of->of_append) {
+      result = VOP_STAT(of->of_vnode, &st);
+      if (!result) {
+        of->of_offset = st.st_size;
+      }
+    }
+    if (!result) {
+      u.uio_offset = of->of_offset;
+      result = (rw == UIO_READ) ? VOP_READ(of->of_vnode, &u) :
+        VOP_WRITE(of->of_vnode, &u);
+      of->of_offset = u.uio_offset;
+    }
+    lock_release(of->of_lock);
+  }
+  openfile_decref(of);
 
-  res = VOP_WRITE(curproc->console,&u);
-  if (res) {
-    return res;
+  /* a partial transfer counts as success */
+  if (result && u.uio_resid == nbytes) {
+    return result;
   }
 
-  /* pass back the number of bytes actually written */
+  /* pass back the number of bytes actually transferred */
   *retval = nbytes - u.uio_resid;
   KASSERT(*retval >= 0);
   return 0;
 }
+
+int
+sys_read(int fdesc, userptr_t ubuf, size_t nbytes, int *retval)
+{
+  return file_rw(fdesc, ubuf, nbytes, UIO_READ, retval);
+}
+
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return file_rw(fdesc, ubuf, nbytes, UIO_WRITE, retval);
+}
+
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int result;
+
+  result = filetable_get(curproc->p_files, fdesc, &of);
+  if (result) {
+    return result;
+  }
+  if (of->of_lock == NULL) {
+    openfile_decref(of);
+    return ESPIPE;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    result = VOP_STAT(of->of_vnode, &st);
+    newpos = st.st_size + pos;
+    break;
+  default:
+    newpos = 0;
+    result = EINVAL;
+    break;
+  }
+  if (!result && newpos < 0) {
+    result = EINVAL;
+  }
+  if (!result) {
+    of->of_offset = newpos;
+    *retval = newpos;
+  }
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return result;
+}
+
+int
+sys_close(int fdesc)
+{
+  return filetable_close(curproc->p_files, fdesc);
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of;
+  int result;
+
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+  result = filetable_get(curproc->p_files, oldfd, &of);
+  if (result) {
+    return result;
+  }
+  if (oldfd == newfd) {
+    openfile_decref(of);
+  }
+  else {
+    filetable_install(curproc->p_files, newfd, of);
+  }
+  *retval = newfd;
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Futex-style user-space wait/wake.
+ *
+ * futex_wait(addr, val) puts the caller to sleep on user address
+ * ADDR, but only if the int there still holds VAL; futex_wake(addr,
+ * n) wakes up to N threads sleeping on ADDR. A user-level lock built
+ * on these only enters the kernel when it is contended: the fast
+ * path is an atomic operation on the lock word in user memory.
+ *
+ * Sleepers are keyed by (address space, vaddr) and hashed into a
+ * fixed table of buckets. Each bucket has a lock, a CV (whose wchan
+ * is what threads actually sleep on) and a list of waiter records
+ * living on the waiters' kernel stacks. The lock is a sleep lock,
+ * not a spinlock, because the value check does a copyin, which can
+ * fault; holding it across the check and the wait is what makes
+ * "compare and sleep" atomic with respect to futex_wake.
+ *
+ * A wake marks up to N matching records and broadcasts the bucket's
+ * CV. Unmarked sleepers whose keys merely collided in the bucket
+ * go back to sleep.
+ *
+ * A sleeper also gives up, with EINTR, if another thread of its
+ * process exits it; exit_curproc kicks every bucket the address
+ * space has sleepers in so they get to look.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	64	/* power of 2 */
+
+struct futex_waiter {
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	unsigned h;
+
+	h = ((uintptr_t)as >> 4) ^ (addr >> 2);
+	h ^= h >> 11;
+	return &futex_table[h & (FUTEX_NBUCKETS - 1)];
+}
+
+static
+int
+futex_check(userptr_t uaddr, struct addrspace **asret)
+{
+	if (((vaddr_t)uaddr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+	*asret = curproc_getas();
+	if (*asret == NULL) {
+		return EFAULT;
+	}
+	return 0;
+}
+
+int
+sys_futex_wait(userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	struct addrspace *as;
+	int cur, result;
+
+	result = futex_check(uaddr, &as);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(as, (vaddr_t)uaddr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	/* queue at the tail, so wakes go first-come first-served */
+	fw.fw_as = as;
+	fw.fw_addr = (vaddr_t)uaddr;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		/* nothing */
+	}
+	*fwp = &fw;
+
+	/* futex_wake unlinks us when it marks us */
+	while (!fw.fw_woken && !curproc->p_exiting) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+	if (!fw.fw_woken) {
+		for (fwp = &fb->fb_waiters; *fwp != &fw;
+		     fwp = &(*fwp)->fw_next) {
+			/* nothing */
+		}
+		*fwp = fw.fw_next;
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t uaddr, int n, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	struct addrspace *as;
+	int result, woken;
+
+	result = futex_check(uaddr, &as);
+	if (result) {
+		return result;
+	}
+	if (n < 0) {
+		return EINVAL;
+	}
+	fb = futex_hash(as, (vaddr_t)uaddr);
+
+	woken = 0;
+	lock_acquire(fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < n) {
+		fw = *fwp;
+		if (fw->fw_as == as && fw->fw_addr == (vaddr_t)uaddr) {
+			*fwp = fw->fw_next;
+			fw->fw_next = NULL;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			fwp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futex_waiter *fw;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		lock_acquire(futex_table[i].fb_lock);
+		for (fw = futex_table[i].fb_waiters; fw != NULL;
+		     fw = fw->fw_next) {
+			if (fw->fw_as == as) {
+				cv_broadcast(futex_table[i].fb_cv,
+					     futex_table[i].fb_lock);
+				break;
+			}
+		}
+		lock_release(futex_table[i].fb_lock);
+	}
+}
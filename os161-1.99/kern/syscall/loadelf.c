@@ -59,6 +59,8 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <spinlock.h>
+#include <percpu.h>
 #include "opt-A3.h"
 #include <mips/tlb.h>
 #include <spl.h>
@@ -149,21 +151,227 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
+ * ELF image cache.
  *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Running the same program over and over (the shell running ls, a
+ * test looping on add) would otherwise mean reading and checking the
+ * ELF header and program headers every time, and reading every
+ * segment, each read a separate trip to the disk or the emufs
+ * device. So load_elf keeps the parsed headers of the last few
+ * executables, keyed by vnode, and for small ones the segment
+ * contents too.
+ *
+ * An entry holds a reference to its vnode, so the vnode can't be
+ * recycled for some other file while it's cached, and records the
+ * vnode's version (see vnode_write); if the file has been written or
+ * truncated since, the entry is thrown away when next looked up.
+ * That reference would also keep a removed file from being freed and
+ * its filesystem from being unmounted, so vfs_remove and the unmount
+ * code call elfcache_forget and elfcache_purge to let go of it.
+ *
+ * Entries are refcounted, so one can be dropped from the cache while
+ * a load is still copying out of it.
+ */
+#define ELFCACHE_SIZE		8		/* entries */
+#define ELFCACHE_MAXDATA	(16*1024)	/* keep contents up to this */
+
+struct elfseg {
+	off_t es_offset;	/* in the file */
+	vaddr_t es_vaddr;
+	size_t es_memsize;
+	size_t es_filesize;
+	uint32_t es_flags;	/* PF_R, PF_W, PF_X */
+	size_t es_dataoff;	/* in ei_data */
+};
+
+struct elfimage {
+	struct vnode *ei_vnode;
+	unsigned ei_version;	/* vn_version when read */
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elfseg *ei_segs;	/* PT_LOAD segments only */
+	char *ei_data;		/* segment contents, or NULL */
+	unsigned ei_refcount;	/* the cache's, plus loads in progress */
+	unsigned ei_lastuse;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_NAMED_INITIALIZER("elfcache");
+static struct elfimage *elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+
+static PERCPU_COUNTER(elfcache_hits, "elfcache_hit");
+static PERCPU_COUNTER(elfcache_misses, "elfcache_miss");
+
+static
+void
+elfimage_release(struct elfimage *img)
+{
+	bool last;
+
+	spinlock_acquire(&elfcache_lock);
+	KASSERT(img->ei_refcount > 0);
+	img->ei_refcount--;
+	last = img->ei_refcount == 0;
+	spinlock_release(&elfcache_lock);
+
+	if (last) {
+		VOP_DECREF(img->ei_vnode);
+		kfree(img->ei_segs);
+		kfree(img->ei_data);
+		kfree(img);
+	}
+}
+
+/*
+ * Find V in the cache. Returns a referenced image, or NULL.
+ */
+static
+struct elfimage *
+elfcache_lookup(struct vnode *v)
+{
+	struct elfimage *img, *stale;
+	unsigned i;
+
+	img = stale = NULL;
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i] != NULL && elfcache[i]->ei_vnode == v) {
+			if (elfcache[i]->ei_version == v->vn_version) {
+				img = elfcache[i];
+				img->ei_refcount++;
+				img->ei_lastuse = ++elfcache_clock;
+			}
+			else {
+				stale = elfcache[i];
+				elfcache[i] = NULL;
+			}
+			break;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	if (stale != NULL) {
+		elfimage_release(stale);
+	}
+	percpu_counter_inc(img ? &elfcache_hits : &elfcache_misses);
+	return img;
+}
+
+/*
+ * Add IMG to the cache, pushing out the least recently used entry if
+ * it's full. Does nothing if V was cached by someone else meanwhile.
+ */
+static
+void
+elfcache_insert(struct elfimage *img)
+{
+	struct elfimage *victim;
+	unsigned i, slot;
+
+	victim = NULL;
+	slot = 0;
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i] == NULL) {
+			slot = i;
+			victim = NULL;
+			break;
+		}
+		if (elfcache[i]->ei_vnode == img->ei_vnode) {
+			spinlock_release(&elfcache_lock);
+			return;
+		}
+		if (victim == NULL ||
+		    elfcache[i]->ei_lastuse < victim->ei_lastuse) {
+			slot = i;
+			victim = elfcache[i];
+		}
+	}
+	elfcache[slot] = img;
+	img->ei_refcount++;
+	img->ei_lastuse = ++elfcache_clock;
+	spinlock_release(&elfcache_lock);
+
+	if (victim != NULL) {
+		elfimage_release(victim);
+	}
+}
+
+/*
+ * Drop every entry for vnode V, or, if V is NULL, for a vnode on FS.
  */
+static
+void
+elfcache_drop(struct vnode *v, struct fs *fs)
+{
+	struct elfimage *drop[ELFCACHE_SIZE];
+	struct vnode *vn;
+	unsigned i, n;
+
+	n = 0;
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i] == NULL) {
+			continue;
+		}
+		vn = elfcache[i]->ei_vnode;
+		if (v != NULL ? vn == v : vn->vn_fs == fs) {
+			drop[n++] = elfcache[i];
+			elfcache[i] = NULL;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	/* VOP_DECREF can sleep */
+	for (i=0; i<n; i++) {
+		elfimage_release(drop[i]);
+	}
+}
+
+void
+elfcache_forget(struct vnode *v)
+{
+	elfcache_drop(v, NULL);
+}
+
+void
+elfcache_purge(struct fs *fs)
+{
+	KASSERT(fs != NULL);
+	elfcache_drop(NULL, fs);
+}
+
+/*
+ * Read and check the headers of the executable V, and, if it's small
+ * enough, its segment contents. Returns a referenced image.
+ */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+elf_read(struct vnode *v, struct elfimage **ret)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
-	int result, i;
+	struct elfimage *img;
+	struct elfseg *es;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
+	size_t datalen;
+	unsigned i;
+	int result;
 
-	as = curproc_getas();
+	img = kmalloc(sizeof(*img));
+	if (img == NULL) {
+		return ENOMEM;
+	}
+	VOP_INCREF(v);
+	img->ei_vnode = v;
+	/* before reading, so a write that races with us makes it stale */
+	img->ei_version = v->vn_version;
+	img->ei_nsegs = 0;
+	img->ei_segs = NULL;
+	img->ei_data = NULL;
+	img->ei_refcount = 1;
+	img->ei_lastuse = 0;
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -172,13 +380,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	uio_kinit(&iov, &ku, &eh, sizeof(eh), 0, UIO_READ);
 	result = VOP_READ(v, &ku);
 	if (result) {
-		return result;
+		goto fail;
 	}
 
 	if (ku.uio_resid != 0) {
 		/* short read; problem with executable? */
 		kprintf("ELF: short read on header - file truncated?\n");
-		return ENOEXEC;
+		result = ENOEXEC;
+		goto fail;
 	}
 
 	/*
@@ -202,11 +411,13 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	    eh.e_version != EV_CURRENT ||
 	    eh.e_type!=ET_EXEC ||
 	    eh.e_machine!=EM_MACHINE) {
-		return ENOEXEC;
+		result = ENOEXEC;
+		goto fail;
 	}
+	img->ei_entry = eh.e_entry;
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Collect the loadable segments.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
@@ -220,19 +431,26 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	img->ei_segs = kmalloc(eh.e_phnum * sizeof(struct elfseg));
+	if (img->ei_segs == NULL && eh.e_phnum > 0) {
+		result = ENOMEM;
+		goto fail;
+	}
+	datalen = 0;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
 
 		result = VOP_READ(v, &ku);
 		if (result) {
-			return result;
+			goto fail;
 		}
 
 		if (ku.uio_resid != 0) {
 			/* short read; problem with executable? */
 			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
+			result = ENOEXEC;
+			goto fail;
 		}
 
 		switch (ph.p_type) {
@@ -243,21 +461,129 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		    default:
 			kprintf("loadelf: unknown segment type %d\n", 
 				ph.p_type);
-			return ENOEXEC;
+			result = ENOEXEC;
+			goto fail;
+		}
+
+		es = &img->ei_segs[img->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsize = ph.p_memsz;
+		es->es_filesize = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+		if (es->es_filesize > es->es_memsize) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			es->es_filesize = es->es_memsize;
+		}
+		es->es_dataoff = datalen;
+		datalen += es->es_filesize;
+	}
+
+	/*
+	 * Keep the contents of small programs. If there's no memory
+	 * for them, don't bother; load_elf can read from the file.
+	 */
+	if (datalen > 0 && datalen <= ELFCACHE_MAXDATA) {
+		img->ei_data = kmalloc(datalen);
+	}
+	for (i=0; img->ei_data != NULL && i<img->ei_nsegs; i++) {
+		es = &img->ei_segs[i];
+		uio_kinit(&iov, &ku, img->ei_data + es->es_dataoff,
+			  es->es_filesize, es->es_offset, UIO_READ);
+		result = VOP_READ(v, &ku);
+		if (result) {
+			goto fail;
+		}
+		if (ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("ELF: short read on segment - file truncated?\n");
+			result = ENOEXEC;
+			goto fail;
 		}
+	}
+
+	*ret = img;
+	return 0;
+
+ fail:
+	elfimage_release(img);
+	return result;
+}
+
+/*
+ * Load a segment from the copy of its contents in the image cache.
+ * Like load_segment, this relies on uiomove to refuse kernel
+ * addresses.
+ */
+static
+int
+load_segment_cached(struct addrspace *as, struct elfimage *img,
+		    struct elfseg *es)
+{
+	struct iovec iov;
+	struct uio u;
+
+	DEBUG(DB_EXEC, "ELF: Loading %lu cached bytes to 0x%lx\n", 
+	      (unsigned long) es->es_filesize, (unsigned long) es->es_vaddr);
+
+	iov.iov_ubase = (userptr_t)es->es_vaddr;
+	iov.iov_len = es->es_memsize;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = es->es_filesize;
+	u.uio_offset = 0;
+	u.uio_segflg = (es->es_flags & PF_X) ? UIO_USERISPACE : UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = as;
+
+	return uiomove(img->ei_data + es->es_dataoff, es->es_filesize, &u);
+}
 
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elfimage *img;
+	struct elfseg *es;
+	struct addrspace *as;
+	unsigned i;
+	int result;
+
+	as = curproc_getas();
+
+	img = elfcache_lookup(v);
+	if (img == NULL) {
+		result = elf_read(v, &img);
+		if (result) {
+			return result;
+		}
+		elfcache_insert(img);
+	}
+
+	/*
+	 * Go through the list of segments and set up the address space.
+	 */
+
+	for (i=0; i<img->ei_nsegs; i++) {
+		es = &img->ei_segs[i];
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  es->es_vaddr, es->es_memsize,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
+			elfimage_release(img);
 			return result;
 		}
 	}
 
 	result = as_prepare_load(as);
 	if (result) {
+		elfimage_release(img);
 		return result;
 	}
 
@@ -265,46 +591,31 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
+	for (i=0; i<img->ei_nsegs; i++) {
+		es = &img->ei_segs[i];
+		if (img->ei_data != NULL) {
+			result = load_segment_cached(as, img, es);
 		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
+		else {
+			result = load_segment(as, v, es->es_offset,
+					      es->es_vaddr, es->es_memsize,
+					      es->es_filesize,
+					      es->es_flags & PF_X);
 		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
-		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
 		if (result) {
+			elfimage_release(img);
 			return result;
 		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
+		elfimage_release(img);
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = img->ei_entry;
+	elfimage_release(img);
 #if OPT_A3
         int spl = splhigh();
         uint32_t ehi = USERSTACK;
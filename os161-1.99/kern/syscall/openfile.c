@@ -0,0 +1,243 @@
+/*
+ * Open files and descriptor tables. See openfile.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <openfile.h>
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *vn;
+	int accmode, result;
+
+	accmode = flags & O_ACCMODE;
+	if (accmode != O_RDONLY && accmode != O_WRONLY && accmode != O_RDWR) {
+		return EINVAL;
+	}
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		kfree(of);
+		return result;
+	}
+
+	of->of_vnode = vn;
+	of->of_accmode = accmode;
+	of->of_append = (flags & O_APPEND) != 0;
+	of->of_lock = NULL;
+	of->of_offset = 0;
+	spinlock_init(&of->of_reflock);
+	of->of_refcount = 1;
+
+	/* devices that can't seek refuse to seek to 0 as well */
+	if (VOP_TRYSEEK(vn, 0) == 0) {
+		of->of_lock = lock_create("openfile");
+		if (of->of_lock == NULL) {
+			vfs_close(vn);
+			spinlock_cleanup(&of->of_reflock);
+			kfree(of);
+			return ENOMEM;
+		}
+	}
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = of->of_refcount == 0;
+	spinlock_release(&of->of_reflock);
+
+	if (last) {
+		vfs_close(of->of_vnode);
+		if (of->of_lock != NULL) {
+			lock_destroy(of->of_lock);
+		}
+		spinlock_cleanup(&of->of_reflock);
+		kfree(of);
+	}
+}
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	spinlock_init(&ft->ft_lock);
+	bzero(ft->ft_files, sizeof(ft->ft_files));
+	ft->ft_lowfree = 0;
+	return ft;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	int fd;
+
+	/* nobody else can be using it now */
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_decref(ft->ft_files[fd]);
+		}
+	}
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+void
+filetable_copy(struct filetable *from, struct filetable *to)
+{
+	int fd;
+
+	spinlock_acquire(&from->ft_lock);
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		KASSERT(to->ft_files[fd] == NULL);
+		if (from->ft_files[fd] != NULL) {
+			openfile_incref(from->ft_files[fd]);
+			to->ft_files[fd] = from->ft_files[fd];
+		}
+	}
+	to->ft_lowfree = from->ft_lowfree;
+	spinlock_release(&from->ft_lock);
+}
+
+int
+filetable_openstd(struct filetable *ft)
+{
+	static const int modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	struct openfile *of;
+	char path[5];
+	int fd, result;
+
+	for (fd = 0; fd < 3; fd++) {
+		/* vfs_open may scribble on the path */
+		strcpy(path, "con:");
+		result = openfile_open(path, modes[fd], 0, &of);
+		if (result) {
+			return result;
+		}
+		filetable_install(ft, fd, of);
+	}
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *ret)
+{
+	int fd;
+
+	spinlock_acquire(&ft->ft_lock);
+	for (fd = ft->ft_lowfree; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] == NULL) {
+			ft->ft_files[fd] = of;
+			ft->ft_lowfree = fd + 1;
+			spinlock_release(&ft->ft_lock);
+			*ret = fd;
+			return 0;
+		}
+	}
+	ft->ft_lowfree = OPEN_MAX;
+	spinlock_release(&ft->ft_lock);
+	return EMFILE;
+}
+
+void
+filetable_install(struct filetable *ft, int fd, struct openfile *of)
+{
+	struct openfile *old;
+
+	KASSERT(fd >= 0 && fd < OPEN_MAX);
+
+	spinlock_acquire(&ft->ft_lock);
+	old = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+	if (of == NULL && fd < ft->ft_lowfree) {
+		ft->ft_lowfree = fd;
+	}
+	spinlock_release(&ft->ft_lock);
+
+	/* closing may sleep, so not under the spinlock */
+	if (old != NULL) {
+		openfile_decref(old);
+	}
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	if (of != NULL) {
+		openfile_incref(of);
+	}
+	spinlock_release(&ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_close(struct filetable *ft, int fd)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	if (of != NULL && fd < ft->ft_lowfree) {
+		ft->ft_lowfree = fd;
+	}
+	spinlock_release(&ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	openfile_decref(of);
+	return 0;
+}
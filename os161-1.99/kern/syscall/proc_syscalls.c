@@ -17,12 +17,51 @@
 #include <kern/fcntl.h>
 #include <vm.h>
 #include <test.h>
+#include <wchan.h>
+#include <clock.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <kern/procstat.h>
+#include <cpu.h>
+#include <openfile.h>
 #endif
 
   /* this implementation of sys__exit does not do anything with the exit code */
   /* this needs to be fixed to get exit() and waitpid() working properly */
 #if OPT_A2
 
+/*
+ * PID table.
+ *
+ * table[] maps a pid straight to its entry, and map[] has one bit
+ * per pid (set if in use) so the allocator can skip 32 busy pids at
+ * a time. New pids are handed out round-robin starting from hint,
+ * the one after the last pid allocated, which makes allocation O(1)
+ * unless the table is nearly full, and keeps a just-freed pid from
+ * being reused right away.
+ *
+ * Each live process keeps a list of its children's entries
+ * (p_children). An entry outlives its process until the parent
+ * collects the wait status from it; when a parent exits, its
+ * children are orphaned (parent set to NULL) and those already dead
+ * are freed, so exit costs time in proportion to the number of
+ * children. Parents sleep on their own p_waitchan and children wake
+ * it when they exit. An exiting child also moves itself to the head
+ * of its parent's list, so waiting for "any child" usually finds one
+ * there.
+ *
+ * A parent can have several threads, so an entry one of them is busy
+ * with is marked held: one is collecting its status, or is in vfork
+ * waiting for the child to let go. Other waiters leave a held entry
+ * alone and sleep until it is released or gone, so a child is only
+ * ever reaped once.
+ *
+ * p_spinlock protects all of it, including p_children. Nothing that
+ * can sleep or allocate is done with it held: entries are set up
+ * before it is taken and freed after it is dropped.
+ */
+#define PIDMAP_WORDS ((PID_MAX + 32) / 32)
+
 struct pidTable *create_pidTable(void){
   struct pidTable* pt;
   pt = kmalloc(sizeof(struct pidTable));
@@ -30,77 +69,246 @@ struct pidTable *create_pidTable(void){
     return NULL;
   }
   pt->numprocs = 0;
-  
-  pt->table = kmalloc(sizeof(struct pidEntry *)*PID_MAX);
-  if (!pt->table) {
-     kfree(pt);
-     return NULL;
-  }
-  //for (int i = 1;i<=PID_MAX;i++){
-  //  pt->table[i] = kmalloc(sizeof(struct pidEntry));
-  //}
-  
-  spinlock_init(&pt->p_spinlock);
-  if (!&pt->p_spinlock){
+  /* pid 1 goes to the kernel; user processes wrap round to PID_MIN */
+  pt->hint = 1;
+
+  pt->table = kmalloc(sizeof(struct pidEntry *)*(PID_MAX + 1));
+  pt->map = kmalloc(sizeof(uint32_t)*PIDMAP_WORDS);
+  if (!pt->table || !pt->map) {
     kfree(pt->table);
+    kfree(pt->map);
     kfree(pt);
     return NULL;
   }
+  bzero(pt->table, sizeof(struct pidEntry *)*(PID_MAX + 1));
+  bzero(pt->map, sizeof(uint32_t)*PIDMAP_WORDS);
+  /* pid 0 is never valid */
+  pt->map[0] = 1;
+
+  spinlock_init(&pt->p_spinlock);
+  spinlock_setname(&pt->p_spinlock, "pidtable");
   return pt;
-  
-  
 }
-int add_pidEntry(struct pidTable *ptable, struct proc *target, struct proc *parent, pid_t *retval){
-  if (ptable->numprocs > PID_MAX){
-    return ENPROC;
+
+/* Find a free pid at or after the hint. Table must be locked. */
+static pid_t pid_alloc(struct pidTable *ptable) {
+  pid_t pid = ptable->hint;
+  unsigned n = 0;
+
+  while (n <= PID_MAX) {
+    if (pid > PID_MAX) {
+      pid = PID_MIN;
+    }
+    if ((pid & 31) == 0 && ptable->map[pid / 32] == 0xffffffff) {
+      pid += 32;
+      n += 32;
+      continue;
+    }
+    if ((ptable->map[pid / 32] & (1U << (pid & 31))) == 0) {
+      ptable->map[pid / 32] |= 1U << (pid & 31);
+      ptable->hint = pid + 1;
+      return pid;
+    }
+    pid++;
+    n++;
   }
-  struct pidEntry *pe;
-  pe = kmalloc(sizeof(struct pidEntry));
-  if (!pe){
-    return ENOMEM;
+  return -1;
+}
+
+/* Put PE at the head of its parent's child list. */
+static void sib_insert(struct pidEntry *pe) {
+  pe->e_sibprev = NULL;
+  pe->e_sibnext = pe->parent->p_children;
+  if (pe->e_sibnext) {
+    pe->e_sibnext->e_sibprev = pe;
   }
-  
-  pe->e_lk = lock_create("entryLock");
-  if (!pe->e_lk) {
-    kfree(pe);
-    return ENOMEM;   
+  pe->parent->p_children = pe;
+}
+
+static void sib_remove(struct pidEntry *pe) {
+  if (pe->e_sibprev) {
+    pe->e_sibprev->e_sibnext = pe->e_sibnext;
+  } else {
+    pe->parent->p_children = pe->e_sibnext;
+  }
+  if (pe->e_sibnext) {
+    pe->e_sibnext->e_sibprev = pe->e_sibprev;
+  }
+}
+
+/*
+ * Take PE out of the table and off its parent's child list, and
+ * push it on *DEAD to be freed once the table is unlocked.
+ */
+static void unlink_pidEntry(struct pidTable *ptable, struct pidEntry *pe,
+                            struct pidEntry **dead) {
+  KASSERT(spinlock_do_i_hold(&ptable->p_spinlock));
+  KASSERT(ptable->table[pe->pid] == pe);
+
+  ptable->table[pe->pid] = NULL;
+  ptable->map[pe->pid / 32] &= ~(1U << (pe->pid & 31));
+  ptable->numprocs -= 1;
+
+  if (pe->parent) {
+    sib_remove(pe);
+    pe->parent = NULL;
   }
- 
-  pe->e_cv  = cv_create("entryCV");
-  if (!pe->e_cv) {
-    kfree(pe->e_lk);
+  pe->e_sibnext = *dead;
+  *dead = pe;
+}
+
+static void free_pidEntries(struct pidEntry *dead) {
+  struct pidEntry *pe;
+
+  while ((pe = dead) != NULL) {
+    dead = pe->e_sibnext;
     kfree(pe);
+  }
+}
+
+int add_pidEntry(struct pidTable *ptable, struct proc *target, struct proc *parent, pid_t *retval){
+  struct pidEntry *pe;
+  pid_t pid;
+
+  pe = kmalloc(sizeof(struct pidEntry));
+  if (!pe){
     return ENOMEM;
   }
   pe->thisProc = target;
   pe->parent = parent;
   pe->exited = 0;
   pe->code = -1;
-  for (int i = 1; i<= PID_MAX;i++){
-    if (!ptable->table[i]){
-      pe->pid = i;
-      ptable->table[pe->pid] = pe;
-      ptable->numprocs += 1;
-      *retval = pe->pid;
-      return 0;
-    }
+  pe->vforking = 0;
+  pe->held = 0;
+  pe->e_sibprev = NULL;
+  pe->e_sibnext = NULL;
+
+  spinlock_acquire(&ptable->p_spinlock);
+  pid = pid_alloc(ptable);
+  if (pid < 0) {
+    spinlock_release(&ptable->p_spinlock);
+    kfree(pe);
+    return ENPROC;
+  }
+  pe->pid = pid;
+  ptable->table[pid] = pe;
+  ptable->numprocs += 1;
+  if (parent) {
+    sib_insert(pe);
   }
-  return ENPROC;
+  spinlock_release(&ptable->p_spinlock);
+
+  target->p_pid = pid;
+  *retval = pid;
+  return 0;
 }
 
 void remove_pidEntry(struct pidTable *ptable, int pid){
-  if (!ptable->table[pid]){
-    return;
+  struct pidEntry *pe, *dead = NULL;
+
+  spinlock_acquire(&ptable->p_spinlock);
+  pe = ptable->table[pid];
+  if (pe) {
+    unlink_pidEntry(ptable, pe, &dead);
   }
-  lock_destroy(ptable->table[pid]->e_lk);
-  cv_destroy(ptable->table[pid]->e_cv);
-  kfree(ptable->table[pid]);
-  ptable->table[pid] = NULL;
-  ptable->numprocs -= 1;
+  spinlock_release(&ptable->p_spinlock);
+  free_pidEntries(dead);
 }
 
+/*
+ * Exit-time bookkeeping for process P, shared by _exit and by fatal
+ * exceptions. STATUS is an encoded wait status (_MKWAIT_*). If P has
+ * a parent its entry stays around, holding STATUS, for waitpid;
+ * otherwise it goes now. P's children are orphaned, and the ones
+ * that have already exited are freed.
+ */
+void exit_pidEntry(struct pidTable *ptable, struct proc *p, int status){
+  struct pidEntry *self, *pe, *next, *dead = NULL;
+  struct usage usage;
 
-int sys_fork(struct trapframe *tf, pid_t *retval) {
+  /* final resource usage, for wait4 and the parent's RUSAGE_CHILDREN */
+  proc_getusage(p, &usage);
+  spinlock_acquire(&p->p_lock);
+  usage_add(&usage, &p->p_cusage);
+  spinlock_release(&p->p_lock);
+
+  spinlock_acquire(&ptable->p_spinlock);
+  self = ptable->table[p->p_pid];
+  KASSERT(self != NULL && self->thisProc == p);
+
+  for (pe = p->p_children; pe != NULL; pe = next) {
+    next = pe->e_sibnext;
+    pe->parent = NULL;
+    pe->e_sibprev = NULL;
+    pe->e_sibnext = NULL;
+    if (pe->exited) {
+      unlink_pidEntry(ptable, pe, &dead);
+    }
+  }
+  p->p_children = NULL;
+
+  self->thisProc = NULL;
+  memcpy(self->comm, p->p_comm, PS_NAMELEN);
+  if (self->parent) {
+    self->exited = 1;
+    self->code = status;
+    self->usage = usage;
+    sib_remove(self);
+    sib_insert(self);
+    wchan_wakeall(self->parent->p_waitchan);
+  } else {
+    unlink_pidEntry(ptable, self, &dead);
+  }
+  spinlock_release(&ptable->p_spinlock);
+
+  free_pidEntries(dead);
+}
+
+/* Undo a partly built fork child. */
+static void fork_abort(struct proc *child) {
+  struct addrspace *as;
+
+  if (child->p_pid != 0) {
+    remove_pidEntry(PID_TABLE, child->p_pid);
+  }
+  as = child->p_addrspace;
+  child->p_addrspace = NULL;
+  if (as && !child->p_vforked) {
+    as_destroy(as);
+  }
+  proc_destroy(child);
+}
+
+/*
+ * Called by a process that is giving up its address space, in execv
+ * or on exit. If P was vforked and so was only borrowing the space,
+ * let the parent carry on and return true: the space is the parent's
+ * and mustn't be destroyed. Otherwise return false.
+ */
+bool vfork_release(struct proc *p) {
+  struct pidEntry *pe;
+
+  if (!p->p_vforked) {
+    return false;
+  }
+  p->p_vforked = false;
+
+  spinlock_acquire(&PID_TABLE->p_spinlock);
+  pe = PID_TABLE->table[p->p_pid];
+  KASSERT(pe != NULL && pe->vforking);
+  pe->vforking = 0;
+  /* the parent is stuck in vfork, so it can't have exited */
+  KASSERT(pe->parent != NULL);
+  wchan_wakeall(pe->parent->p_waitchan);
+  spinlock_release(&PID_TABLE->p_spinlock);
+  return true;
+}
+
+/*
+ * fork and vfork. With SHARE set the child gets our address space
+ * rather than a copy, and we wait here until it lets go of it.
+ */
+static int do_fork(struct trapframe *tf, bool share, pid_t *retval) {
   
   struct proc *child = proc_create_runprogram("child");
   if (!child) {
@@ -108,32 +316,53 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   }
 
   struct addrspace *newas;
-  int a_result = as_copy(curproc_getas(), &newas);
+  if (share) {
+    newas = curproc_getas();
+    child->p_vforked = true;
+  } else {
+    int a_result = as_copy(curproc_getas(), &newas);
 
-  if (a_result) {
-    kprintf("addrspace copy failed: %s\n", strerror(a_result));
-    kfree(newas);
-    proc_destroy(child);
-    return a_result;
+    if (a_result) {
+      proc_destroy(child);
+      return a_result;
+    }
   }
 
 
   spinlock_acquire(&child->p_lock);
   child->p_addrspace = newas;
+  memcpy(child->p_comm, curproc->p_comm, PS_NAMELEN);
+  /* the child's thread keeps our thread id, and so our stack */
+  child->p_tidmap = 1 << curthread->t_tid;
   spinlock_release(&child->p_lock);
+
+  /* the child shares our open files, offsets and all */
+  filetable_copy(curproc->p_files, child->p_files);
   
-  spinlock_acquire(&PID_TABLE->p_spinlock);
   int err = add_pidEntry(PID_TABLE, child, curproc, retval);
-  spinlock_release(&PID_TABLE->p_spinlock);
   if (err) {
-    proc_destroy(child);
+    fork_abort(child);
     return err;
   }
 
+  /*
+   * The child hasn't run, so it can't have exited or been reaped yet.
+   * Hold its entry so that no other thread of ours reaps it, and frees
+   * it, between its letting us go and our seeing that it has.
+   */
+  struct pidEntry *pe = NULL;
+  if (share) {
+    spinlock_acquire(&PID_TABLE->p_spinlock);
+    pe = PID_TABLE->table[*retval];
+    pe->vforking = 1;
+    pe->held = 1;
+    spinlock_release(&PID_TABLE->p_spinlock);
+  }
+
   struct trapframe *trfr;
   trfr = kmalloc(sizeof(struct trapframe));
   if (!trfr){
-    proc_destroy(child);
+    fork_abort(child);
     return ENOMEM;
   }
 
@@ -178,53 +407,133 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   int result = thread_fork("forked thread",
                        child,
                        (void *)enter_forked_process,
-                       (void *)trfr, 0);
+                       (void *)trfr, curthread->t_tid);
   if (result) {
-    kprintf("thread_fork failed: %s\n", strerror(result));
-    proc_destroy(child);
+    kfree(trfr);
+    fork_abort(child);
     return result;
   }
+
+  if (share) {
+    spinlock_acquire(&PID_TABLE->p_spinlock);
+    while (pe->vforking) {
+      wchan_lock(curproc->p_waitchan);
+      spinlock_release(&PID_TABLE->p_spinlock);
+      wchan_sleep(curproc->p_waitchan);
+      spinlock_acquire(&PID_TABLE->p_spinlock);
+    }
+    pe->held = 0;
+    /* for other threads waiting on the child */
+    wchan_wakeall(curproc->p_waitchan);
+    spinlock_release(&PID_TABLE->p_spinlock);
+  }
   return 0;
 
 }
+
+int sys_fork(struct trapframe *tf, pid_t *retval) {
+  return do_fork(tf, false, retval);
+}
+
+int sys_vfork(struct trapframe *tf, pid_t *retval) {
+  return do_fork(tf, true, retval);
+}
+#endif
+
+#if OPT_A2
+/*
+ * Take the current thread out of process P for good. The last user
+ * thread out takes the process with it, exiting with the status
+ * exit_curproc recorded, or 0 if every thread just called
+ * thread_exit.
+ */
+static void uthread_leave(struct proc *p) {
+  struct addrspace *as;
+  int status;
+  bool last;
+
+  /*
+   * Detach before we stop being counted, so whoever turns out to be
+   * last finds no one else in P's thread array.
+   */
+  proc_remthread(curthread);
+
+  spinlock_acquire(&p->p_lock);
+  KASSERT(p->p_nuthreads > 0);
+  p->p_nuthreads--;
+  last = p->p_nuthreads == 0;
+  status = p->p_exiting ? p->p_exitstatus : _MKWAIT_EXIT(0);
+  spinlock_release(&p->p_lock);
+  if (!last) {
+    /* P may be gone already */
+    thread_exit();
+  }
+
+  KASSERT(p->p_addrspace != NULL);
+  as_deactivate();
+  /* as in sys__exit below, clear p_addrspace before as_destroy */
+  spinlock_acquire(&p->p_lock);
+  as = p->p_addrspace;
+  p->p_addrspace = NULL;
+  spinlock_release(&p->p_lock);
+  /*
+   * A vforked child lets its parent go before it becomes a zombie:
+   * once exit_pidEntry has run, the parent may reap it and free its
+   * table entry, and vfork_release would find nothing there.
+   */
+  if (!vfork_release(p)) {
+    as_destroy(as);
+  }
+
+  exit_pidEntry(PID_TABLE, p, status);
+
+  /*
+   * Closing files and freeing P can sleep, so hand it to the work
+   * queue rather than hold up our exit. If this is the last user
+   * process in the system, proc_destroy() will wake up the kernel
+   * menu thread.
+   */
+  proc_destroy_deferred(p);
+  thread_exit();
+}
+
+void exit_curproc(int status) {
+  struct proc *p = curproc;
+  bool others = false;
+
+  spinlock_acquire(&p->p_lock);
+  if (!p->p_exiting) {
+    p->p_exiting = true;
+    p->p_exitstatus = status;
+    others = p->p_nuthreads > 1;
+  }
+  spinlock_release(&p->p_lock);
+
+  if (others) {
+    /*
+     * Threads asleep in thread_join, waitpid or futex_wait check
+     * p_exiting when they wake; the rest will notice on their way
+     * back to user mode (see mips_trap).
+     */
+    wchan_wakeall(p->p_waitchan);
+    futex_wakeall(curproc_getas());
+  }
+  uthread_leave(p);
+  panic("return from uthread_leave\n");
+}
 #endif
 
 void sys__exit(int exitcode) {
   
+#if OPT_A2
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  exit_curproc(_MKWAIT_EXIT(exitcode));
+#else
   struct addrspace *as;
   struct proc *p = curproc;
   /* for now, just include this to keep the compiler from complaining about
      an unused variable */
-#if OPT_A2
-  pid_t pid;
-  sys_getpid(&pid);
-  
-  if(PID_TABLE->table[pid]->parent){
-    lock_acquire(PID_TABLE->table[pid]->e_lk);
-    PID_TABLE->table[pid]->exited = 1;
-    PID_TABLE->table[pid]->code = exitcode;
-    cv_signal(PID_TABLE->table[pid]->e_cv, PID_TABLE->table[pid]->e_lk);
-    spinlock_acquire(&PID_TABLE->p_spinlock);
-    for (int i =1;i<=PID_MAX;i++){
-      if (PID_TABLE->table[i] && PID_TABLE->table[i]->parent == curproc && PID_TABLE->table[i]->exited){
-        remove_pidEntry(PID_TABLE, i);
-      }
-    }
-    spinlock_release(&PID_TABLE->p_spinlock);
-    lock_release(PID_TABLE->table[pid]->e_lk);  
-  } else {
-    spinlock_acquire(&PID_TABLE->p_spinlock);
-    for (int i =1;i<=PID_MAX;i++){
-      if (PID_TABLE->table[i] && PID_TABLE->table[i]->parent == curproc && PID_TABLE->table[i]->exited){
-        remove_pidEntry(PID_TABLE, i);
-      }
-    }
-    remove_pidEntry(PID_TABLE, pid);
-    spinlock_release(&PID_TABLE->p_spinlock);
-  }
-#else
   (void)exitcode;
-#endif
 
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
@@ -249,6 +558,7 @@ void sys__exit(int exitcode) {
   proc_destroy(p);
   
   thread_exit();
+#endif
   /* thread_exit() does not return, so we should never get here */
   panic("return from thread_exit in sys_exit\n");
 }
@@ -259,14 +569,8 @@ int
 sys_getpid(pid_t *retval)
 {
 #if OPT_A2
-  for (int i = 1;i<=PID_MAX;i++){
-    if (PID_TABLE->table[i] && curproc == PID_TABLE->table[i]->thisProc && !PID_TABLE->table[i]->exited){
-      *retval = PID_TABLE->table[i]->pid;
-      return 0;
-    }
-  }
-  //panic("get_pid failed to get current proc from PID_TABLE");
-  return -1;
+  *retval = curproc->p_pid;
+  return 0;
 #else
   /* for now, this is just a stub that always returns a PID of 1 */
   /* you need to fix this to make it work properly */
@@ -275,6 +579,119 @@ sys_getpid(pid_t *retval)
 #endif
 }
 
+#if OPT_A2
+/*
+ * Convert usage counts to the form getrusage and wait4 return.
+ * Resident set sizes and I/O counts aren't kept, and without paging
+ * there are no major faults or swaps, so those are all 0.
+ */
+static void usage_to_rusage(const struct usage *u, struct rusage *ru) {
+  bzero(ru, sizeof(*ru));
+  ru->ru_utime.tv_sec = u->u_uticks / HZ;
+  ru->ru_utime.tv_usec = (u->u_uticks % HZ) * (1000000 / HZ);
+  ru->ru_stime.tv_sec = u->u_sticks / HZ;
+  ru->ru_stime.tv_usec = (u->u_sticks % HZ) * (1000000 / HZ);
+  ru->ru_minflt = u->u_minflt;
+  ru->ru_nvcsw = u->u_nvcsw;
+  ru->ru_nivcsw = u->u_nivcsw;
+}
+
+/*
+ * waitpid and wait4. If RUSAGE isn't NULL the child's resource usage,
+ * including that of the children it reaped, is copied out there.
+ */
+static int do_wait(pid_t pid, userptr_t status, int options,
+                   userptr_t rusage, pid_t *retval) {
+  if ((options & ~WNOHANG) != 0) {
+    return(EINVAL);
+  }
+  struct pidEntry *pe;
+  struct usage usage;
+  struct rusage ru;
+  int exitstatus;
+  int result;
+
+  /* no process groups, so -1 (any child) is the only special pid */
+  if (pid != -1 && (pid < 1 || pid > PID_MAX)) {
+    return ESRCH;
+  }
+  spinlock_acquire(&PID_TABLE->p_spinlock);
+  while (1) {
+    if (pid == -1) {
+      if (!curproc->p_children) {
+        spinlock_release(&PID_TABLE->p_spinlock);
+        return ECHILD;
+      }
+      for (pe = curproc->p_children; pe != NULL; pe = pe->e_sibnext) {
+        if (pe->exited && !pe->held) {
+          break;
+        }
+      }
+    } else {
+      pe = PID_TABLE->table[pid];
+      if (!pe) {
+        spinlock_release(&PID_TABLE->p_spinlock);
+        return ESRCH;
+      }
+      if (pe->parent != curproc) {
+        spinlock_release(&PID_TABLE->p_spinlock);
+        return ECHILD;
+      }
+      if (!pe->exited || pe->held) {
+        pe = NULL;
+      }
+    }
+    if (pe != NULL || (options & WNOHANG)) {
+      break;
+    }
+    wchan_lock(curproc->p_waitchan);
+    /* checked with the channel locked; see exit_curproc */
+    if (curproc->p_exiting) {
+      wchan_unlock(curproc->p_waitchan);
+      spinlock_release(&PID_TABLE->p_spinlock);
+      return EINTR;
+    }
+    spinlock_release(&PID_TABLE->p_spinlock);
+    wchan_sleep(curproc->p_waitchan);
+    spinlock_acquire(&PID_TABLE->p_spinlock);
+  }
+  if (pe == NULL) {
+    /* WNOHANG and nothing to collect yet */
+    spinlock_release(&PID_TABLE->p_spinlock);
+    *retval = 0;
+    return 0;
+  }
+  /* held, pe stays put, and is ours alone to reap, from here */
+  pe->held = 1;
+  pid = pe->pid;
+  exitstatus = pe->code;
+  usage = pe->usage;
+  spinlock_release(&PID_TABLE->p_spinlock);
+
+  /* leave the child unreaped if the status can't be delivered */
+  result = copyout((void *)&exitstatus,status,sizeof(int));
+  if (!result && rusage != NULL) {
+    usage_to_rusage(&usage, &ru);
+    result = copyout(&ru, rusage, sizeof(ru));
+  }
+  if (result) {
+    spinlock_acquire(&PID_TABLE->p_spinlock);
+    pe->held = 0;
+    wchan_wakeall(curproc->p_waitchan);
+    spinlock_release(&PID_TABLE->p_spinlock);
+    return result;
+  }
+  remove_pidEntry(PID_TABLE, pid);
+
+  spinlock_acquire(&curproc->p_lock);
+  usage_add(&curproc->p_cusage, &usage);
+  spinlock_release(&curproc->p_lock);
+
+  *retval = pid;
+  return 0;
+}
+#endif
+
 /* stub handler for waitpid() system call                */
 
 int
@@ -283,6 +700,9 @@ sys_waitpid(pid_t pid,
 	    int options,
 	    pid_t *retval)
 {
+#if OPT_A2
+  return do_wait(pid, status, options, NULL, retval);
+#else
   int exitstatus;
   int result;
 
@@ -298,32 +718,6 @@ sys_waitpid(pid_t pid,
   if (options != 0) {
     return(EINVAL);
   }
-#if OPT_A2
-  if (PID_TABLE->table[pid] && PID_TABLE->table[pid]->parent == curproc){
-    lock_acquire(PID_TABLE->table[pid]->e_lk);
-    while (!PID_TABLE->table[pid]->exited){
-      cv_wait(PID_TABLE->table[pid]->e_cv, PID_TABLE->table[pid]->e_lk);
-    }
-    exitstatus = _MKWAIT_EXIT(PID_TABLE->table[pid]->code);
-    spinlock_acquire(&PID_TABLE->p_spinlock);
-    lock_release(PID_TABLE->table[pid]->e_lk);
-    
-    result = copyout((void *)&exitstatus,status,sizeof(int));
-    if (result) {
-      spinlock_release(&PID_TABLE->p_spinlock);
-      return EFAULT;
-    }
-    remove_pidEntry(PID_TABLE, pid);
-    spinlock_release(&PID_TABLE->p_spinlock);
-    *retval = pid;
-    return 0;
-    
-  } else if(!PID_TABLE->table[pid]->parent){
-    return ESRCH;
-  } else {
-    return ECHILD;
-  }
-#else
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
   result = copyout((void *)&exitstatus,status,sizeof(int));
@@ -336,17 +730,321 @@ sys_waitpid(pid_t pid,
 }
 
 #if OPT_A2
-int sys_execv(userptr_t progname, userptr_t args)
+int
+sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+          pid_t *retval)
 {
-  (void)args;
+  return do_wait(pid, status, options, rusage, retval);
+}
+
+int
+sys_getrusage(int who, userptr_t rusage)
+{
+  struct usage usage;
+  struct rusage ru;
+
+  switch (who) {
+  case RUSAGE_SELF:
+    proc_getusage(curproc, &usage);
+    break;
+  case RUSAGE_CHILDREN:
+    spinlock_acquire(&curproc->p_lock);
+    usage = curproc->p_cusage;
+    spinlock_release(&curproc->p_lock);
+    break;
+  default:
+    return EINVAL;
+  }
+  usage_to_rusage(&usage, &ru);
+  return copyout(&ru, rusage, sizeof(ru));
+}
+
+/*
+ * Fill in PI for live process P. Called with the table lock held,
+ * which keeps P from finishing its exit, and takes p_lock, which
+ * keeps its threads and address space where they are.
+ */
+static void procstat_fill(struct proc *p, struct procinfo *pi) {
+  struct thread *t;
+  uint64_t ticks;
+  unsigned i, num, recent;
+  bool running;
+
+  spinlock_acquire(&p->p_lock);
+  memcpy(pi->pi_name, p->p_comm, PS_NAMELEN);
+  ticks = p->p_usage.u_uticks + p->p_usage.u_sticks;
+  recent = 0;
+  running = false;
+  num = threadarray_num(&p->p_threads);
+  for (i=0; i<num; i++) {
+    t = threadarray_get(&p->p_threads, i);
+    ticks += t->t_usage.u_uticks + t->t_usage.u_sticks;
+    recent += thread_recentcpu(t);
+    if (t->t_state == S_RUN || t->t_state == S_READY) {
+      running = true;
+    }
+  }
+  pi->pi_nthreads = num;
+  pi->pi_respages = p->p_addrspace ? as_respages(p->p_addrspace) : 0;
+  spinlock_release(&p->p_lock);
+
+  pi->pi_state = running ? PS_RUN : PS_SLEEP;
+  pi->pi_cputicks = ticks;
+  pi->pi_recent = recent * 1000 / HZ;
+}
+
+/*
+ * Fill in up to MAX entries of BUF with the processes whose pids are
+ * *NEXT or above, in pid order, and set *NEXT to carry on from
+ * there. Returns the number filled in, 0 once there are no more.
+ * The table lock is held throughout, so BUF must not be user memory.
+ */
+unsigned procstat_collect(pid_t *next, struct procinfo *buf, unsigned max) {
+  struct pidTable *pt = PID_TABLE;
+  struct pidEntry *pe;
+  struct procinfo *pi;
+  pid_t pid;
+  unsigned n = 0;
+
+  spinlock_acquire(&pt->p_spinlock);
+  for (pid = *next; pid <= PID_MAX && n < max; pid++) {
+    if ((pid & 31) == 0 && pt->map[pid / 32] == 0) {
+      pid += 31;
+      continue;
+    }
+    pe = pt->table[pid];
+    if (pe == NULL) {
+      continue;
+    }
+    pi = &buf[n++];
+    bzero(pi, sizeof(*pi));
+    pi->pi_pid = pid;
+    pi->pi_ppid = pe->parent ? pe->parent->p_pid : 0;
+    if (pe->exited) {
+      pi->pi_state = PS_ZOMBIE;
+      pi->pi_cputicks = pe->usage.u_uticks + pe->usage.u_sticks;
+      memcpy(pi->pi_name, pe->comm, PS_NAMELEN);
+    }
+    else if (pe->thisProc != NULL) {
+      procstat_fill(pe->thisProc, pi);
+    }
+  }
+  spinlock_release(&pt->p_spinlock);
+  *next = pid;
+  return n;
+}
+
+void procstat_system(struct sysstat *ss) {
+  size_t used;
+  unsigned pages;
+
+  kheap_getusage(&used, &pages);
+  bzero(ss, sizeof(*ss));
+  ss->ss_uptime = clock_uptime();
+  ss->ss_ncpus = cpu_count();
+  ss->ss_hz = HZ;
+  spinlock_acquire(&PID_TABLE->p_spinlock);
+  ss->ss_nprocs = PID_TABLE->numprocs;
+  spinlock_release(&PID_TABLE->p_spinlock);
+  ss->ss_heapused = used;
+  ss->ss_heappages = pages;
+}
+
+/*
+ * procinfos copied out per pass through the table. The buffer is
+ * kmalloc'd; 16 of them are too much for the kernel stack.
+ */
+#define PROCSTAT_CHUNK 16
+
+int
+sys_procstat(userptr_t buf, int n, userptr_t sysstat, int *retval)
+{
+  struct procinfo *chunk;
+  struct sysstat ss;
+  unsigned got, want;
+  pid_t next;
+  int copied, result;
+
+  if (n < 0) {
+    return EINVAL;
+  }
+
+  chunk = NULL;
+  if (n > 0) {
+    chunk = kmalloc(PROCSTAT_CHUNK * sizeof(*chunk));
+    if (chunk == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  copied = 0;
+  next = PID_MIN;
+  result = 0;
+  while (copied < n) {
+    want = n - copied;
+    if (want > PROCSTAT_CHUNK) {
+      want = PROCSTAT_CHUNK;
+    }
+    got = procstat_collect(&next, chunk, want);
+    if (got == 0) {
+      break;
+    }
+    result = copyout(chunk, (userptr_t)((struct procinfo *)buf + copied),
+                     got * sizeof(chunk[0]));
+    if (result) {
+      break;
+    }
+    copied += got;
+  }
+  kfree(chunk);
+  if (result) {
+    return result;
+  }
+
+  if (sysstat != NULL) {
+    procstat_system(&ss);
+    result = copyout(&ss, sysstat, sizeof(ss));
+    if (result) {
+      return result;
+    }
+  }
+
+  *retval = copied;
+  return 0;
+}
+#endif
+
+#if OPT_A2
+/*
+ * execv staging buffers.
+ *
+ * execv and spawn copy the program name and the argument strings
+ * into a staging buffer, and build the new argv block there - the
+ * pointer array followed by the strings, laid out exactly as it will
+ * sit at the top of the new user stack - so that it goes out in a
+ * single copyout. spawn also stages its descriptor list at the end.
+ * The buffers are over PATH_MAX + ARG_MAX bytes, too big to allocate
+ * on every exec (dumbvm never gives multi-page allocations back), so
+ * they are kept on a free list and reused. There are only ever as
+ * many of them as there have been execs in progress at once.
+ */
+#define EXECBUF_SIZE (PATH_MAX + ARG_MAX + OPEN_MAX * sizeof(int))
+
+static struct spinlock execbuf_lock = SPINLOCK_NAMED_INITIALIZER("execbuf");
+static void *execbuf_free;
+
+static char *execbuf_get(void) {
+  void *buf;
+
+  spinlock_acquire(&execbuf_lock);
+  buf = execbuf_free;
+  if (buf) {
+    execbuf_free = *(void **)buf;
+  }
+  spinlock_release(&execbuf_lock);
+  if (!buf) {
+    buf = kmalloc(EXECBUF_SIZE);
+  }
+  return buf;
+}
+
+static void execbuf_put(char *buf) {
+  spinlock_acquire(&execbuf_lock);
+  *(void **)buf = execbuf_free;
+  execbuf_free = buf;
+  spinlock_release(&execbuf_lock);
+}
+
+/*
+ * Copy in the user argv array at UARGV, and the strings it points to,
+ * and lay them out in BUF (ARG_MAX bytes): argc+1 pointers, then the
+ * strings. The pointers are left as offsets into BUF, to be fixed up
+ * once we know where on the stack the block goes. Sets *ARGC, and
+ * *LEN to the size of the block. The block has to fit on the new
+ * image's stack, so it is held to EXEC_ARGMAX, not ARG_MAX; E2BIG
+ * comes back from here, before anything of the old image is gone.
+ */
+static int execv_copyin_args(userptr_t uargv, char *buf, int *argc, size_t *len) {
+  userptr_t *ptrs = (userptr_t *)buf;
+  size_t max = EXEC_ARGMAX / sizeof(userptr_t);
+  size_t n, i, chunk, off, got;
+  vaddr_t va;
+  int result;
+
+  if ((vaddr_t)uargv % sizeof(userptr_t) != 0) {
+    return EFAULT;
+  }
+
+  /*
+   * The pointer array, a page at a time: the array can end anywhere,
+   * and copying past the page its terminator is on might fault.
+   */
+  n = 0;
+  while (1) {
+    va = (vaddr_t)uargv + n * sizeof(userptr_t);
+    chunk = (PAGE_SIZE - (va & ~PAGE_FRAME)) / sizeof(userptr_t);
+    if (chunk > max - n) {
+      chunk = max - n;
+    }
+    if (chunk == 0) {
+      return E2BIG;
+    }
+    result = copyin((const_userptr_t)va, &ptrs[n], chunk * sizeof(userptr_t));
+    if (result) {
+      return result;
+    }
+    for (i = n; i < n + chunk && ptrs[i] != NULL; i++) {
+      /* nothing */
+    }
+    if (i < n + chunk) {
+      n = i;
+      break;
+    }
+    n += chunk;
+  }
+
+  /* The strings, straight into place after the pointers. */
+  off = (n + 1) * sizeof(userptr_t);
+  for (i = 0; i < n; i++) {
+    if (off >= EXEC_ARGMAX) {
+      return E2BIG;
+    }
+    result = copyinstr((const_userptr_t)ptrs[i], buf + off, EXEC_ARGMAX - off, &got);
+    if (result == ENAMETOOLONG) {
+      return E2BIG;
+    }
+    if (result) {
+      return result;
+    }
+    ptrs[i] = (userptr_t)off;
+    off += got;
+  }
+  ptrs[n] = NULL;
+
+  *argc = n;
+  *len = off;
+  return 0;
+}
+
+/*
+ * Build a new address space from the executable at PATH, with the
+ * argv block that execv_copyin_args left in ARGBUF at the top of its
+ * stack. To load it, the current thread works in it alone (through
+ * t_loadas; see curproc_getas), so any other threads of ours carry
+ * on undisturbed in the old one. On return the thread is back in
+ * the old space either way, and on success the new one is handed
+ * back in RETAS.
+ */
+static int exec_image(char *path, char *argbuf, int argc, size_t len,
+                      struct addrspace **retas, vaddr_t *entrypoint,
+                      vaddr_t *stackptr) {
   struct addrspace *as;
-  struct addrspace *old_as = curproc_getas();
+  userptr_t *argv = (userptr_t *)argbuf;
   struct vnode *v;
-  vaddr_t entrypoint, stackptr;
-  int result;
+  int i, result;
 
-  /* Open the file. */
-  result = vfs_open((char *)progname, O_RDONLY, 0, &v);
+  /* Open the file. vfs_open may scribble on path. */
+  result = vfs_open(path, O_RDONLY, 0, &v);
   if (result) {
     return result;
   }
@@ -355,40 +1053,441 @@ int sys_execv(userptr_t progname, userptr_t args)
   as = as_create();
   if (as ==NULL) {
     vfs_close(v);
-  return ENOMEM;
+    return ENOMEM;
   }
 
   /* Switch to it and activate it. */
-  curproc_setas(as);
+  curthread->t_loadas = as;
   as_activate();
 
   /* Load the executable. */
-  result = load_elf(v, &entrypoint);
-  if (result) {
-    curproc_setas(old_as);
-    as_activate();
-    vfs_close(v);
-    return result;
-  }
+  result = load_elf(v, entrypoint);
 
   /* Done with the file now. */
   vfs_close(v);
 
   /* Define the user stack in the address space */
-  result = as_define_stack(as, &stackptr);
+  if (!result) {
+    result = as_define_stack(as, stackptr);
+  }
+
+  /* Put the argv block at the top of the stack. */
+  if (!result) {
+    *stackptr -= ROUNDUP(len, 8);
+    for (i = 0; i < argc; i++) {
+      argv[i] = (userptr_t)(*stackptr + (vaddr_t)argv[i]);
+    }
+    result = copyout(argbuf, (userptr_t)*stackptr, len);
+  }
+
+  curthread->t_loadas = NULL;
+  as_activate();
   if (result) {
-    curproc_setas(old_as);
-    as_activate();
+    as_destroy(as);
     return result;
-    }
-  as_destroy(old_as);
+  }
+  *retas = as;
+  return 0;
+}
+
+int sys_execv(userptr_t progname, userptr_t args)
+{
+  struct proc *p = curproc;
+  struct addrspace *as;
+  struct addrspace *old_as;
+  vaddr_t entrypoint, stackptr;
+  char *buf, *path, *argbuf;
+  size_t len;
+  int argc;
+  int result;
+
+  /*
+   * Only a process's last thread can exec; it'd have to kill the
+   * others first. Only live threads make new ones, so this can't
+   * change under us.
+   */
+  spinlock_acquire(&p->p_lock);
+  if (p->p_nuthreads > 1) {
+    spinlock_release(&p->p_lock);
+    return EBUSY;
+  }
+  spinlock_release(&p->p_lock);
+
+  buf = execbuf_get();
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+  path = buf;
+  argbuf = buf + PATH_MAX;
+
+  /* Everything from the old image has to be copied in first. */
+  result = copyinstr(progname, path, PATH_MAX, NULL);
+  if (!result) {
+    result = execv_copyin_args(args, argbuf, &argc, &len);
+  }
+  if (!result) {
+    result = exec_image(path, argbuf, argc, len, &as, &entrypoint, &stackptr);
+  }
+  if (!result) {
+    proc_setcomm(p, path);
+  }
+  execbuf_put(buf);
+  if (result) {
+    return result;
+  }
+
+  old_as = curproc_setas(as);
+  as_activate();
+  if (!vfork_release(p)) {
+    as_destroy(old_as);
+  }
+
+  /* we're the first thread of the new image, on its one stack */
+  spinlock_acquire(&p->p_lock);
+  curthread->t_tid = 0;
+  p->p_tidmap = 1;
+  bzero(p->p_uthreads, sizeof(p->p_uthreads));
+  spinlock_release(&p->p_lock);
+
   /* Warp to user mode. */
-  enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
+  enter_new_process(argc, (userptr_t)stackptr /*userspace addr of argv*/,
                     stackptr, entrypoint);
 
   /* enter_new_process does not return. */
   panic("enter_new_process returned\n");
   return EINVAL;
+}
+
+/*
+ * spawn: start a new child process running PROGNAME with ARGS, built
+ * straight from the executable instead of by copying ourselves and
+ * then replacing the copy. The child's address space is loaded from
+ * here, with exec_image, so the child thread just has to jump to user
+ * mode.
+ *
+ * FDS (NFDS entries, may be NULL if NFDS is 0) says what the child's
+ * descriptors are: its descriptor i shares the open file of our
+ * fds[i], or is closed if fds[i] is -1. With NFDS 0 it shares our
+ * descriptors 0, 1 and 2. Nothing else is inherited.
+ */
+static int spawn_setfds(struct proc *child, const int *fds, int nfds) {
+  struct openfile *of;
+  int i, result;
+
+  if (nfds == 0) {
+    for (i = 0; i <= STDERR_FILENO; i++) {
+      if (filetable_get(curproc->p_files, i, &of) == 0) {
+        filetable_install(child->p_files, i, of);
+      }
+    }
+    return 0;
+  }
+  for (i = 0; i < nfds; i++) {
+    if (fds[i] == -1) {
+      continue;
+    }
+    result = filetable_get(curproc->p_files, fds[i], &of);
+    if (result) {
+      return result;
+    }
+    filetable_install(child->p_files, i, of);
+  }
+  return 0;
+}
+
+struct spawn_start {
+  vaddr_t ss_entrypoint;
+  vaddr_t ss_stackptr;
+  int ss_argc;
+};
+
+static void spawn_enter(void *data1, unsigned long data2) {
+  struct spawn_start ss;
+
+  (void)data2;
+  ss = *(struct spawn_start *)data1;
+  kfree(data1);
+  as_activate();
+  enter_new_process(ss.ss_argc, (userptr_t)ss.ss_stackptr,
+                    ss.ss_stackptr, ss.ss_entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+int sys_spawn(userptr_t progname, userptr_t args, userptr_t ufds, int nfds,
+              pid_t *retval)
+{
+  struct proc *child;
+  struct addrspace *as;
+  struct spawn_start *ss;
+  char *buf, *path, *argbuf;
+  int *fds;
+  size_t len;
+  int argc;
+  int result;
+
+  if (nfds < 0 || nfds > OPEN_MAX) {
+    return EINVAL;
+  }
+
+  buf = execbuf_get();
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+  path = buf;
+  argbuf = buf + PATH_MAX;
+  fds = (int *)(argbuf + ARG_MAX);
+
+  result = copyinstr(progname, path, PATH_MAX, NULL);
+  if (!result) {
+    result = execv_copyin_args(args, argbuf, &argc, &len);
+  }
+  if (!result && nfds > 0) {
+    result = copyin(ufds, fds, nfds * sizeof(int));
+  }
+  if (result) {
+    execbuf_put(buf);
+    return result;
+  }
+
+  ss = kmalloc(sizeof(*ss));
+  child = proc_create_runprogram(path);
+  if (ss == NULL || child == NULL) {
+    kfree(ss);
+    if (child) {
+      proc_destroy(child);
+    }
+    execbuf_put(buf);
+    return ENOMEM;
+  }
 
+  result = spawn_setfds(child, fds, nfds);
+  if (result) {
+    kfree(ss);
+    proc_destroy(child);
+    execbuf_put(buf);
+    return result;
+  }
+
+  result = exec_image(path, argbuf, argc, len, &as, &ss->ss_entrypoint,
+                      &ss->ss_stackptr);
+  execbuf_put(buf);
+  if (result) {
+    kfree(ss);
+    proc_destroy(child);
+    return result;
+  }
+  ss->ss_argc = argc;
+  spinlock_acquire(&child->p_lock);
+  child->p_addrspace = as;
+  spinlock_release(&child->p_lock);
+
+  result = add_pidEntry(PID_TABLE, child, curproc, retval);
+  if (result) {
+    kfree(ss);
+    fork_abort(child);
+    return result;
+  }
+
+  result = thread_fork("spawned thread", child, spawn_enter, ss, 0);
+  if (result) {
+    kfree(ss);
+    fork_abort(child);
+    return result;
+  }
+  return 0;
+}
+
+/*
+ * User threads.
+ *
+ * Every thread of a process runs in its address space, each on its
+ * own user stack (as_define_tstack). Thread ids are small integers,
+ * 0 being the thread the process started with; an id stays taken
+ * after its thread exits until someone collects the return value
+ * with thread_join. The new thread starts at ENTRY(FUNC, ARG), where
+ * ENTRY is libc's trampoline that calls FUNC(ARG) and then
+ * thread_exit with its result.
+ *
+ * Threads are forked onto the least busy cpu (thread_fork_spread),
+ * so the threads of one program run in parallel from the start.
+ */
+struct uthread_start {
+  vaddr_t us_entry;
+  vaddr_t us_func;
+  vaddr_t us_arg;
+  vaddr_t us_stackptr;
+};
+
+static void uthread_enter(void *data1, unsigned long data2) {
+  struct uthread_start us;
+
+  us = *(struct uthread_start *)data1;
+  kfree(data1);
+  curthread->t_tid = data2;
+  if (curproc->p_exiting) {
+    exit_curproc(0);
+  }
+  enter_new_process((int)us.us_func, (userptr_t)us.us_arg,
+                    us.us_stackptr, us.us_entry);
+  panic("enter_new_process returned\n");
+}
+
+int sys_thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+                      int *retval)
+{
+  struct proc *p = curproc;
+  struct uthread_start *us;
+  unsigned tid;
+  int result;
+
+  us = kmalloc(sizeof(*us));
+  if (us == NULL) {
+    return ENOMEM;
+  }
+  us->us_entry = (vaddr_t)entry;
+  us->us_func = (vaddr_t)func;
+  us->us_arg = (vaddr_t)arg;
+
+  spinlock_acquire(&p->p_lock);
+  for (tid = 1; tid < THREAD_MAX && (p->p_tidmap & (1 << tid)); tid++) {
+    /* nothing */
+  }
+  if (tid == THREAD_MAX) {
+    spinlock_release(&p->p_lock);
+    kfree(us);
+    return EAGAIN;
+  }
+  p->p_tidmap |= 1 << tid;
+  bzero(&p->p_uthreads[tid], sizeof(p->p_uthreads[tid]));
+  p->p_nuthreads++;
+  spinlock_release(&p->p_lock);
+
+  result = as_define_tstack(curproc_getas(), tid, &us->us_stackptr);
+  if (!result) {
+    result = thread_fork_spread(p->p_name, p, uthread_enter, us, tid);
+  }
+  if (result) {
+    kfree(us);
+    spinlock_acquire(&p->p_lock);
+    p->p_tidmap &= ~(1 << tid);
+    p->p_nuthreads--;
+    spinlock_release(&p->p_lock);
+    return result;
+  }
+
+  *retval = tid;
+  return 0;
+}
+
+void sys_thread_exit(userptr_t retval) {
+  struct proc *p = curproc;
+  struct uthread *ut = &p->p_uthreads[curthread->t_tid];
+
+  spinlock_acquire(&p->p_lock);
+  ut->ut_exited = true;
+  ut->ut_retval = retval;
+  wchan_wakeall(p->p_waitchan);
+  spinlock_release(&p->p_lock);
+
+  uthread_leave(p);
+  panic("return from uthread_leave\n");
+}
+
+int sys_thread_join(int tid, userptr_t retval)
+{
+  struct proc *p = curproc;
+  struct uthread *ut;
+  userptr_t val;
+  int result;
+
+  if (tid < 0 || tid >= THREAD_MAX) {
+    return ESRCH;
+  }
+  if ((unsigned)tid == curthread->t_tid) {
+    return EINVAL;
+  }
+  ut = &p->p_uthreads[tid];
+
+  spinlock_acquire(&p->p_lock);
+  if ((p->p_tidmap & (1 << tid)) == 0) {
+    spinlock_release(&p->p_lock);
+    return ESRCH;
+  }
+  if (ut->ut_joining) {
+    spinlock_release(&p->p_lock);
+    return EINVAL;
+  }
+  ut->ut_joining = true;
+  while (!ut->ut_exited && !p->p_exiting) {
+    wchan_lock(p->p_waitchan);
+    spinlock_release(&p->p_lock);
+    wchan_sleep(p->p_waitchan);
+    spinlock_acquire(&p->p_lock);
+  }
+  if (!ut->ut_exited) {
+    ut->ut_joining = false;
+    spinlock_release(&p->p_lock);
+    return EINTR;
+  }
+  val = ut->ut_retval;
+  spinlock_release(&p->p_lock);
+
+  /* leave it joinable if the value can't be delivered */
+  if (retval != NULL) {
+    result = copyout(&val, retval, sizeof(val));
+    if (result) {
+      spinlock_acquire(&p->p_lock);
+      ut->ut_joining = false;
+      spinlock_release(&p->p_lock);
+      return result;
+    }
+  }
+
+  spinlock_acquire(&p->p_lock);
+  p->p_tidmap &= ~(1 << tid);
+  spinlock_release(&p->p_lock);
+  return 0;
 }
 #endif
+
+/*
+ * setshare() system call: put process PID (0 meaning the caller) in
+ * the stride scheduling class with TICKETS shares of the cpu, or back
+ * in the round-robin class if TICKETS is 0. A process may only change
+ * itself or its own children.
+ */
+int
+sys_setshare(pid_t pid, int tickets)
+{
+  int schedclass;
+  int result;
+
+  if (tickets < 0) {
+    return EINVAL;
+  }
+  schedclass = (tickets == 0) ? SCHED_RR : SCHED_STRIDE;
+
+  if (pid == 0) {
+    return proc_setshare(curproc, schedclass, tickets);
+  }
+
+#if OPT_A2
+  if (pid > 0 && pid <= PID_MAX) {
+    struct pidEntry *pe;
+
+    /* hold the table lock so the target can't be reaped under us */
+    result = ESRCH;
+    spinlock_acquire(&PID_TABLE->p_spinlock);
+    pe = PID_TABLE->table[pid];
+    if (pe != NULL && !pe->exited &&
+        (pe->thisProc == curproc || pe->parent == curproc)) {
+      result = proc_setshare(pe->thisProc, schedclass, tickets);
+    }
+    spinlock_release(&PID_TABLE->p_spinlock);
+    return result;
+  }
+#else
+  (void)result;
+#endif
+  return ESRCH;
+}
@@ -44,6 +44,7 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <openfile.h>
 #include "opt-A2.h"
 
 /*
@@ -60,6 +61,12 @@ runprogram(char *progname)
 	vaddr_t entrypoint, stackptr;
 	int result;
 
+	/* Standard input, output and error go to the console. */
+	result = filetable_openstd(curproc->p_files);
+	if (result) {
+		return result;
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
@@ -99,9 +106,7 @@ runprogram(char *progname)
 	}
 #if OPT_A2
         pid_t rv = 0;
-        spinlock_acquire(&PID_TABLE->p_spinlock);
         int err = add_pidEntry(PID_TABLE, curproc, NULL, &rv);
-        spinlock_release(&PID_TABLE->p_spinlock);
         if(err){
           return err;
         }
@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,36 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for the requested interval. Nothing can interrupt
+ * the sleep early, so if the caller asks for the remaining time it is
+ * always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	clocknanosleep(ts.tv_sec, ts.tv_nsec);
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * RCU read-side benchmark.
+ *
+ * Reader threads look up entries in a small shared table as fast as
+ * they can while an updater thread keeps replacing entries. Each run
+ * is done twice, once with readers taking a spinlock around the
+ * lookup and once with rcu_read_lock, for 1, 2, ... reader threads.
+ * With the spinlock, total throughput stays flat (or drops) as
+ * readers are added; with RCU it should grow with the number of
+ * cpus.
+ *
+ * Each entry carries a check value derived from its key, so a reader
+ * that sees a freed (and scribbled on, or reused) entry will notice.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <rcu.h>
+#include <test.h>
+
+#define RCUB_NITEMS		16
+#define RCUB_MAXTHREADS		16
+#define RCUB_SECONDS		2
+
+struct rcub_item {
+	struct rcu_head ri_rcu;		/* must be first */
+	unsigned ri_val;
+	unsigned ri_check;
+};
+
+static struct rcub_item *rcub_table[RCUB_NITEMS];
+static struct spinlock rcub_lock = SPINLOCK_INITIALIZER;
+
+static volatile bool rcub_userc;
+static volatile bool rcub_stop;
+static volatile bool rcub_bad;
+static volatile unsigned long rcub_count[RCUB_MAXTHREADS];
+static struct semaphore *rcub_donesem;
+
+#define RCUB_CHECK(val)	((val) * 3 + 1)
+
+static
+struct rcub_item *
+rcub_newitem(unsigned val)
+{
+	struct rcub_item *ri;
+
+	ri = kmalloc(sizeof(*ri));
+	if (ri == NULL) {
+		panic("rcutest: out of memory\n");
+	}
+	ri->ri_val = val;
+	ri->ri_check = RCUB_CHECK(val);
+	return ri;
+}
+
+static
+void
+rcub_free(struct rcu_head *rh)
+{
+	struct rcub_item *ri = (struct rcub_item *)rh;
+
+	/* scribble on it, so a late reader will fail its check */
+	ri->ri_check = 0;
+	kfree(ri);
+}
+
+static
+void
+rcubreader(void *junk, unsigned long num)
+{
+	struct rcub_item *ri;
+	unsigned long n;
+	unsigned i, val, check;
+
+	(void)junk;
+
+	n = 0;
+	i = num;
+	while (!rcub_stop) {
+		i = (i + 1) % RCUB_NITEMS;
+		if (rcub_userc) {
+			rcu_read_lock();
+			ri = rcu_dereference(rcub_table[i]);
+			val = ri->ri_val;
+			check = ri->ri_check;
+			rcu_read_unlock();
+		}
+		else {
+			spinlock_acquire(&rcub_lock);
+			ri = rcub_table[i];
+			val = ri->ri_val;
+			check = ri->ri_check;
+			spinlock_release(&rcub_lock);
+		}
+		if (check != RCUB_CHECK(val)) {
+			rcub_bad = true;
+		}
+		n++;
+	}
+	rcub_count[num] = n;
+	V(rcub_donesem);
+}
+
+static
+void
+rcubupdater(void *junk, unsigned long junk2)
+{
+	struct rcub_item *ri, *old;
+	unsigned i, val;
+
+	(void)junk;
+	(void)junk2;
+
+	i = 0;
+	val = RCUB_NITEMS;
+	while (!rcub_stop) {
+		ri = rcub_newitem(val++);
+		spinlock_acquire(&rcub_lock);
+		old = rcub_table[i];
+		rcu_assign_pointer(rcub_table[i], ri);
+		spinlock_release(&rcub_lock);
+		if (rcub_userc) {
+			call_rcu(&old->ri_rcu, rcub_free);
+		}
+		else {
+			/* readers hold the spinlock, so nobody can see it */
+			rcub_free(&old->ri_rcu);
+		}
+		i = (i + 1) % RCUB_NITEMS;
+		clocknap(1);
+	}
+	V(rcub_donesem);
+}
+
+/*
+ * One timed run; returns total reader lookups per second.
+ */
+static
+unsigned long
+rcub_run(bool userc, unsigned nthreads)
+{
+	unsigned long total;
+	unsigned i;
+	int result;
+
+	rcub_userc = userc;
+	rcub_stop = false;
+	for (i=0; i<nthreads; i++) {
+		rcub_count[i] = 0;
+		result = thread_fork("rcutest", NULL, rcubreader, NULL, i);
+		if (result) {
+			panic("rcutest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("rcutest", NULL, rcubupdater, NULL, 0);
+	if (result) {
+		panic("rcutest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	clocksleep(RCUB_SECONDS);
+	rcub_stop = true;
+	for (i=0; i<nthreads+1; i++) {
+		P(rcub_donesem);
+	}
+
+	total = 0;
+	for (i=0; i<nthreads; i++) {
+		total += rcub_count[i];
+	}
+	return total / RCUB_SECONDS;
+}
+
+int
+rcutest(int nargs, char **args)
+{
+	unsigned long lockrate, rcurate;
+	unsigned i, maxthreads;
+
+	maxthreads = cpu_count();
+	if (nargs > 1) {
+		maxthreads = atoi(args[1]);
+	}
+	if (maxthreads < 1 || maxthreads > RCUB_MAXTHREADS) {
+		kprintf("Usage: rcu [nthreads]  (1-%d)\n", RCUB_MAXTHREADS);
+		return EINVAL;
+	}
+
+	rcub_donesem = sem_create("rcutest", 0);
+	if (rcub_donesem == NULL) {
+		panic("rcutest: sem_create failed\n");
+	}
+	for (i=0; i<RCUB_NITEMS; i++) {
+		rcub_table[i] = rcub_newitem(i);
+	}
+	rcub_bad = false;
+
+	kprintf("Starting RCU read-side benchmark (%d sec per run)...\n",
+		RCUB_SECONDS);
+	kprintf("readers   spinlock lookups/s        rcu lookups/s\n");
+	for (i=1; i<=maxthreads; i++) {
+		lockrate = rcub_run(false, i);
+		rcurate = rcub_run(true, i);
+		kprintf("%7u %20lu %20lu\n", i, lockrate, rcurate);
+	}
+
+	/* all readers are gone, so the rest can be freed directly */
+	for (i=0; i<RCUB_NITEMS; i++) {
+		rcub_free(&rcub_table[i]->ri_rcu);
+		rcub_table[i] = NULL;
+	}
+	sem_destroy(rcub_donesem);
+	rcub_donesem = NULL;
+
+	if (rcub_bad) {
+		kprintf("rcutest: FAILED: a reader saw a freed entry\n");
+	}
+	else {
+		kprintf("rcutest: done.\n");
+	}
+	return rcub_bad ? EIO : 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * Scheduler tests.
+ *
+ * sharetest: proportional-share scheduling. Starts a few cpu-bound
+ * threads in the stride scheduling class with different ticket
+ * counts, lets them compete for a while, and checks that the work
+ * each one got done is proportional to its tickets.
+ *
+ * pitest: priority inheritance. A low-share thread holds a lock that
+ * a high-share thread wants while a medium-share thread hogs the cpu.
+ * Run once with lock priority inheritance off, to show the inversion,
+ * and once with it on.
+ *
+ * The threads are all started on the current cpu, but on a
+ * multiprocessor they will be spread out by migration and stealing,
+ * and then each gets a whole cpu to itself regardless of its share.
+ * Run these with cpus=1 in sys161.conf to get meaningful numbers.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define SHARE_NTHREADS	3
+#define SHARE_SECONDS	3
+#define SHARE_TOLERANCE	10	/* percent of the expected share */
+
+static const unsigned share_tickets[SHARE_NTHREADS] = { 300, 200, 100 };
+
+static volatile unsigned long share_count[SHARE_NTHREADS];
+static volatile bool share_go;
+static volatile bool share_stop;
+static struct semaphore *share_readysem;
+static struct semaphore *share_donesem;
+
+static
+void
+sharethread(void *junk, unsigned long num)
+{
+	int result;
+
+	(void)junk;
+
+	result = thread_setshare(curthread, SCHED_STRIDE, share_tickets[num]);
+	if (result) {
+		panic("sharetest: thread_setshare: %s\n", strerror(result));
+	}
+
+	V(share_readysem);
+	while (!share_go) {
+		thread_yield();
+	}
+	while (!share_stop) {
+		share_count[num]++;
+	}
+	V(share_donesem);
+}
+
+int
+sharetest(int nargs, char **args)
+{
+	unsigned long total;
+	unsigned totaltickets, expected, got, diff;
+	char name[16];
+	int i, result, failed;
+
+	(void)nargs;
+	(void)args;
+
+	share_readysem = sem_create("share_ready", 0);
+	share_donesem = sem_create("share_done", 0);
+	if (share_readysem == NULL || share_donesem == NULL) {
+		panic("sharetest: sem_create failed\n");
+	}
+
+	kprintf("Starting stride share test (%d seconds)...\n",
+		SHARE_SECONDS);
+
+	share_go = share_stop = false;
+	totaltickets = 0;
+	for (i=0; i<SHARE_NTHREADS; i++) {
+		share_count[i] = 0;
+		totaltickets += share_tickets[i];
+		snprintf(name, sizeof(name), "sharetest%d", i);
+		result = thread_fork(name, NULL, sharethread, NULL, i);
+		if (result) {
+			panic("sharetest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<SHARE_NTHREADS; i++) {
+		P(share_readysem);
+	}
+
+	share_go = true;
+	clocksleep(SHARE_SECONDS);
+	share_stop = true;
+
+	for (i=0; i<SHARE_NTHREADS; i++) {
+		P(share_donesem);
+	}
+
+	total = 0;
+	for (i=0; i<SHARE_NTHREADS; i++) {
+		total += share_count[i];
+	}
+	if (total == 0) {
+		kprintf("sharetest: no work was done?\n");
+		return EINVAL;
+	}
+
+	/* shares are in tenths of a percent */
+	failed = 0;
+	for (i=0; i<SHARE_NTHREADS; i++) {
+		expected = share_tickets[i] * 1000 / totaltickets;
+		got = (unsigned)((uint64_t)share_count[i] * 1000
+				 / total);
+		diff = got > expected ? got - expected : expected - got;
+		if (diff * 100 > expected * SHARE_TOLERANCE) {
+			failed = 1;
+		}
+		kprintf("Thread %d: %4u tickets, expected %3u.%u%%, "
+			"got %3u.%u%%%s\n", i, share_tickets[i],
+			expected / 10, expected % 10, got / 10, got % 10,
+			diff * 100 > expected * SHARE_TOLERANCE ?
+			" (out of tolerance)" : "");
+	}
+
+	sem_destroy(share_readysem);
+	sem_destroy(share_donesem);
+	share_readysem = share_donesem = NULL;
+
+	kprintf("Stride share test %s.\n", failed ? "FAILED" : "done");
+	return failed ? EIO : 0;
+}
+
+////////////////////////////////////////////////////////////
+
+#define PI_LOTICKETS	10
+#define PI_MEDTICKETS	500
+#define PI_HITICKETS	1000
+#define PI_WORK		100000	/* loops the low thread does holding the lock */
+
+static struct lock *pi_testlock;
+static struct semaphore *pi_heldsem;
+static struct semaphore *pi_donesem;
+static volatile bool pi_stop;
+static volatile unsigned long pi_waitusecs;
+
+static
+void
+pi_setshare(unsigned tickets)
+{
+	int result;
+
+	result = thread_setshare(curthread, SCHED_STRIDE, tickets);
+	if (result) {
+		panic("pitest: thread_setshare: %s\n", strerror(result));
+	}
+}
+
+static
+void
+pi_lothread(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+
+	(void)junk;
+	(void)num;
+
+	pi_setshare(PI_LOTICKETS);
+	lock_acquire(pi_testlock);
+	V(pi_heldsem);
+	for (i=0; i<PI_WORK; i++) {
+		/* nothing */
+	}
+	lock_release(pi_testlock);
+	V(pi_donesem);
+}
+
+static
+void
+pi_medthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pi_setshare(PI_MEDTICKETS);
+	while (!pi_stop) {
+		/* hog */
+	}
+	V(pi_donesem);
+}
+
+static
+void
+pi_hithread(void *junk, unsigned long num)
+{
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+
+	(void)junk;
+	(void)num;
+
+	pi_setshare(PI_HITICKETS);
+	gettime(&secs1, &nsecs1);
+	lock_acquire(pi_testlock);
+	gettime(&secs2, &nsecs2);
+	lock_release(pi_testlock);
+
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+	pi_waitusecs = secs * 1000000 + nsecs / 1000;
+	pi_stop = true;
+	V(pi_donesem);
+}
+
+/*
+ * Run the scenario once; returns how long the high thread waited, in
+ * microseconds.
+ */
+static
+unsigned long
+pi_run(bool inherit)
+{
+	int result, i;
+
+	lock_pi_enable(inherit);
+	pi_stop = false;
+
+	result = thread_fork("pi-lo", NULL, pi_lothread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(pi_heldsem);
+
+	result = thread_fork("pi-med", NULL, pi_medthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("pi-hi", NULL, pi_hithread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	for (i=0; i<3; i++) {
+		P(pi_donesem);
+	}
+	return pi_waitusecs;
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned long without, with;
+
+	(void)nargs;
+	(void)args;
+
+	pi_testlock = lock_create("pi_testlock");
+	pi_heldsem = sem_create("pi_held", 0);
+	pi_donesem = sem_create("pi_done", 0);
+	if (pi_testlock == NULL || pi_heldsem == NULL || pi_donesem == NULL) {
+		panic("pitest: out of memory\n");
+	}
+
+	kprintf("Starting priority inheritance test...\n");
+	kprintf("Tickets: holder %d, hog %d, waiter %d\n",
+		PI_LOTICKETS, PI_MEDTICKETS, PI_HITICKETS);
+
+	without = pi_run(false);
+	kprintf("Without inheritance, waiter blocked %lu.%03lu ms\n",
+		without / 1000, without % 1000);
+	with = pi_run(true);
+	kprintf("With inheritance,    waiter blocked %lu.%03lu ms\n",
+		with / 1000, with % 1000);
+
+	lock_pi_enable(true);
+	lock_destroy(pi_testlock);
+	sem_destroy(pi_heldsem);
+	sem_destroy(pi_donesem);
+
+	/*
+	 * The holder's share goes from 10/510 to 1000/1500 of the cpu,
+	 * so the wait should shrink by much more than this.
+	 */
+	if (with * 4 >= without) {
+		kprintf("Priority inheritance test FAILED.\n");
+		return EIO;
+	}
+	kprintf("Priority inheritance test done.\n");
+	return 0;
+}
@@ -32,16 +32,23 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
+#include <spinlock.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
 #define NTHREADS      32
+#define NRWLOOPS      200
+#define NRWPERFLOOPS  2000
+#define RWWRITEEVERY  16
+#define SPINBENCH_MAXTHREADS 16
+#define SPINBENCH_SECONDS    2
 
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
@@ -247,6 +254,7 @@ locktest(int nargs, char **args)
 	for (i=0; i<NTHREADS; i++) {
 		P(donesem);
 	}
+	lock_print_stats(testlock);
 
 #ifdef UW
   cleanitems();
@@ -347,3 +355,407 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock tests.
+
+static struct rwlock *testrw;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rw_nreaders;
+static volatile unsigned rw_nwriters;
+static volatile unsigned rw_maxreaders;
+static const char *volatile rw_failmsg;
+
+/*
+ * Record the first failure; it's reported at the end, since the
+ * checks run with rwcount_lock held and can't kprintf there.
+ */
+static
+void
+rwfail(const char *msg)
+{
+	if (rw_failmsg == NULL) {
+		rw_failmsg = msg;
+	}
+}
+
+/*
+ * Burn a little time inside the critical section so holders overlap.
+ */
+static
+void
+rwdelay(unsigned n)
+{
+	volatile unsigned j;
+
+	for (j=0; j<n; j++);
+}
+
+static
+void
+rwreader(void)
+{
+	unsigned long v1, v2, v3;
+
+	rwlock_acquire_read(testrw);
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nreaders++;
+	if (rw_nreaders > rw_maxreaders) {
+		rw_maxreaders = rw_nreaders;
+	}
+	if (rw_nwriters != 0) {
+		rwfail("reader running alongside a writer");
+	}
+	spinlock_release(&rwcount_lock);
+
+	v1 = testval1;
+	rwdelay(100);
+	v2 = testval2;
+	v3 = testval3;
+	if (v2 != v1*v1 || v3 != v1%3) {
+		rwfail("reader saw a half-done write");
+	}
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nreaders--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_read(testrw);
+}
+
+static
+void
+rwwriter(unsigned long num)
+{
+	rwlock_acquire_write(testrw);
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nwriters++;
+	if (rw_nwriters != 1 || rw_nreaders != 0) {
+		rwfail("writer not alone");
+	}
+	spinlock_release(&rwcount_lock);
+
+	testval1 = num;
+	rwdelay(100);
+	testval2 = num*num;
+	testval3 = num%3;
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nwriters--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_write(testrw);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		/* every fourth thread writes now and then */
+		if (num % 4 == 0 && i % 8 == 0) {
+			rwwriter(num);
+		}
+		else {
+			rwreader();
+		}
+	}
+	V(donesem);
+	thread_exit();
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+	rw_nreaders = rw_nwriters = rw_maxreaders = 0;
+	rw_failmsg = NULL;
+
+	kprintf("Starting rwlock test...\n");
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Most readers inside at once: %u\n", rw_maxreaders);
+	if (rw_failmsg != NULL) {
+		kprintf("rwlock test FAILED: %s\n", rw_failmsg);
+		return EIO;
+	}
+	kprintf("rwlock test done\n");
+
+	return 0;
+}
+
+/*
+ * Throughput comparison: the same read-mostly workload (one write in
+ * RWWRITEEVERY operations) run once under the rwlock and once under a
+ * plain lock. Readers only help when there is more than one CPU to
+ * overlap them on.
+ */
+static volatile bool rwperf_userw;
+
+static
+void
+rwperfthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWPERFLOOPS; i++) {
+		if (i % RWWRITEEVERY == 0) {
+			if (rwperf_userw) {
+				rwlock_acquire_write(testrw);
+			}
+			else {
+				lock_acquire(testlock);
+			}
+			testval1 = num;
+			rwdelay(50);
+			if (rwperf_userw) {
+				rwlock_release_write(testrw);
+			}
+			else {
+				lock_release(testlock);
+			}
+		}
+		else {
+			if (rwperf_userw) {
+				rwlock_acquire_read(testrw);
+			}
+			else {
+				lock_acquire(testlock);
+			}
+			(void)testval1;
+			rwdelay(50);
+			if (rwperf_userw) {
+				rwlock_release_read(testrw);
+			}
+			else {
+				lock_release(testlock);
+			}
+		}
+	}
+	V(donesem);
+	thread_exit();
+}
+
+static
+void
+rwperfrun(bool userw)
+{
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	uint64_t usecs, ops;
+	int i, result;
+
+	rwperf_userw = userw;
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwperf", NULL, rwperfthread, NULL, i);
+		if (result) {
+			panic("rwperf: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+	usecs = (uint64_t)secs * 1000000 + nsecs / 1000;
+	ops = (uint64_t)NTHREADS * NRWPERFLOOPS;
+	kprintf("%-6s %6lu.%03lu s  %8lu ops/s\n",
+		userw ? "rwlock" : "lock",
+		(unsigned long)secs, (unsigned long)(nsecs / 1000000),
+		usecs ? (unsigned long)(ops * 1000000 / usecs) : 0UL);
+}
+
+int
+rwperftest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwperf: rwlock_create failed\n");
+	}
+
+	kprintf("rwlock vs lock, %d threads x %d ops, 1 in %d writes\n",
+		NTHREADS, NRWPERFLOOPS, RWWRITEEVERY);
+	rwperfrun(false);
+	rwperfrun(true);
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("rwlock throughput test done\n");
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Spinlock fairness and throughput benchmark.
+//
+// A few threads hammer one spinlock for a fixed time, holding it
+// briefly each time, and count how often each got it. Run once with
+// the default test-and-set lock and once with a ticket lock. This
+// only means anything with more than one CPU (cpus=N in sys161.conf);
+// use about as many threads as CPUs, or the scheduler decides who
+// gets the lock.
+
+static struct spinlock spinbench_lock;
+static volatile bool spinbench_stop;
+static volatile unsigned long spinbench_shared;
+static unsigned long spinbench_counts[SPINBENCH_MAXTHREADS];
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	unsigned long n = 0;
+
+	(void)junk;
+
+	while (!spinbench_stop) {
+		spinlock_acquire(&spinbench_lock);
+		spinbench_shared++;
+		rwdelay(20);
+		spinlock_release(&spinbench_lock);
+		n++;
+	}
+	spinbench_counts[num] = n;
+	V(donesem);
+	thread_exit();
+}
+
+static
+void
+spinbenchrun(unsigned nthreads, bool fair)
+{
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	unsigned long total, min, max;
+	uint64_t sumsq, usecs;
+	unsigned i;
+	int result;
+
+	if (fair) {
+		spinlock_init_fair(&spinbench_lock);
+	}
+	else {
+		spinlock_init(&spinbench_lock);
+	}
+	spinbench_stop = false;
+	spinbench_shared = 0;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(SPINBENCH_SECONDS);
+	spinbench_stop = true;
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+	spinlock_cleanup(&spinbench_lock);
+
+	total = 0;
+	sumsq = 0;
+	min = max = spinbench_counts[0];
+	for (i=0; i<nthreads; i++) {
+		total += spinbench_counts[i];
+		sumsq += (uint64_t)spinbench_counts[i] * spinbench_counts[i];
+		if (spinbench_counts[i] < min) {
+			min = spinbench_counts[i];
+		}
+		if (spinbench_counts[i] > max) {
+			max = spinbench_counts[i];
+		}
+	}
+
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+	usecs = (uint64_t)secs * 1000000 + nsecs / 1000;
+
+	/*
+	 * Jain's fairness index, sum^2 / (n * sum of squares), in
+	 * thousandths: 1000 is perfectly even, 1000/n is one thread
+	 * getting everything.
+	 */
+	kprintf("%-6s %8lu ops/s  per-thread min %lu max %lu  "
+		"fairness %lu/1000%s\n",
+		fair ? "ticket" : "tas",
+		usecs ? (unsigned long)((uint64_t)total * 1000000 / usecs) : 0UL,
+		min, max,
+		sumsq ? (unsigned long)((uint64_t)total * total * 1000 /
+					(nthreads * sumsq)) : 0UL,
+		total == spinbench_shared ? "" : "  (COUNT MISMATCH)");
+}
+
+int
+spinbenchtest(int nargs, char **args)
+{
+	unsigned nthreads = 4;
+
+	if (nargs == 2) {
+		nthreads = atoi(args[1]);
+	}
+	if (nthreads < 1 || nthreads > SPINBENCH_MAXTHREADS) {
+		kprintf("Usage: sy6 [nthreads (1-%d)]\n",
+			SPINBENCH_MAXTHREADS);
+		return EINVAL;
+	}
+
+	inititems();
+	kprintf("Spinlock benchmark: %u threads, %d seconds each\n",
+		nthreads, SPINBENCH_SECONDS);
+	spinbenchrun(nthreads, false);
+	spinbenchrun(nthreads, true);
+#ifdef UW
+	cleanitems();
+#endif
+	kprintf("Spinlock benchmark done\n");
+
+	return 0;
+}
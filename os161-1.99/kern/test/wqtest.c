@@ -0,0 +1,176 @@
+/*
+ * Work queue test.
+ *
+ * Queues a batch of work items on every cpu and checks that each ran
+ * exactly once, on the cpu it was queued for, in the order queued.
+ * Then checks that queueing pending work is refused, that delayed
+ * work can be cancelled, and that delayed work doesn't run early.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQT_PERCPU	32
+#define WQT_MAXCPUS	32
+#define WQT_DELAYMS	100
+
+struct wqt_item {
+	struct work wi_work;
+	unsigned wi_cpu;		/* cpu it was queued on */
+	unsigned wi_seq;		/* order queued on that cpu */
+	volatile unsigned wi_runs;
+	volatile unsigned wi_rancpu;
+};
+
+static struct wqt_item *wqt_items;
+static volatile unsigned wqt_lastseq[WQT_MAXCPUS];
+static volatile bool wqt_outoforder;
+static struct semaphore *wqt_sem;
+static volatile uint64_t wqt_ranat;
+
+static
+uint64_t
+wqt_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+static
+void
+wqt_func(void *data)
+{
+	struct wqt_item *wi = data;
+	unsigned cpu;
+
+	cpu = curcpu->c_number;
+	wi->wi_rancpu = cpu;
+	wi->wi_runs++;
+	if (wi->wi_seq != wqt_lastseq[cpu] + 1) {
+		wqt_outoforder = true;
+	}
+	wqt_lastseq[cpu] = wi->wi_seq;
+}
+
+static
+void
+wqt_delayfunc(void *data)
+{
+	(void)data;
+	wqt_ranat = wqt_now();
+	V(wqt_sem);
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	struct wqt_item *wi;
+	struct work dw;
+	unsigned i, j, ncpus, n;
+	uint64_t start, elapsed;
+	int failures;
+
+	(void)nargs;
+	(void)args;
+
+	ncpus = cpu_count();
+	KASSERT(ncpus <= WQT_MAXCPUS);
+	n = ncpus * WQT_PERCPU;
+	failures = 0;
+
+	wqt_items = kmalloc(n * sizeof(*wqt_items));
+	wqt_sem = sem_create("wqtest", 0);
+	if (wqt_items == NULL || wqt_sem == NULL) {
+		panic("wqtest: out of memory\n");
+	}
+
+	kprintf("Starting work queue test (%u cpus)...\n", ncpus);
+
+	/* ordering and placement */
+	wqt_outoforder = false;
+	for (i=0; i<ncpus; i++) {
+		wqt_lastseq[i] = 0;
+	}
+	for (j=0; j<WQT_PERCPU; j++) {
+		for (i=0; i<ncpus; i++) {
+			wi = &wqt_items[i * WQT_PERCPU + j];
+			work_init(&wi->wi_work, wqt_func, wi);
+			wi->wi_cpu = i;
+			wi->wi_seq = j + 1;
+			wi->wi_runs = 0;
+			wi->wi_rancpu = ~0U;
+			if (!workqueue_add_on(i, &wi->wi_work)) {
+				kprintf("wqtest: fresh item refused\n");
+				failures++;
+			}
+		}
+	}
+	workqueue_flush();
+	for (i=0; i<n; i++) {
+		wi = &wqt_items[i];
+		if (wi->wi_runs != 1 || wi->wi_rancpu != wi->wi_cpu) {
+			kprintf("wqtest: item %u for cpu %u ran %u times, "
+				"on cpu %u\n", i, wi->wi_cpu, wi->wi_runs,
+				wi->wi_rancpu);
+			failures++;
+		}
+	}
+	if (wqt_outoforder) {
+		kprintf("wqtest: items ran out of order\n");
+		failures++;
+	}
+
+	/* pending and cancel */
+	work_init(&dw, wqt_delayfunc, NULL);
+	if (!workqueue_add_delayed(&dw, clock_ticks(60, 0))) {
+		kprintf("wqtest: delayed item refused\n");
+		failures++;
+	}
+	if (workqueue_add(&dw)) {
+		kprintf("wqtest: pending item queued twice\n");
+		failures++;
+	}
+	if (!workqueue_cancel(&dw)) {
+		kprintf("wqtest: cancel of delayed item failed\n");
+		failures++;
+	}
+	if (workqueue_cancel(&dw)) {
+		kprintf("wqtest: cancelled item cancelled again\n");
+		failures++;
+	}
+
+	/* delay */
+	start = wqt_now();
+	workqueue_add_delayed(&dw, clock_ticks(0, WQT_DELAYMS * 1000000));
+	P(wqt_sem);
+	elapsed = wqt_ranat - start;
+	kprintf("wqtest: %u ms delay ran after %lu us\n", WQT_DELAYMS,
+		(unsigned long)(elapsed / 1000));
+	if (elapsed < (uint64_t)WQT_DELAYMS * 1000000) {
+		kprintf("wqtest: delayed item ran early\n");
+		failures++;
+	}
+	workqueue_flush();
+
+	kfree(wqt_items);
+	sem_destroy(wqt_sem);
+
+	if (failures) {
+		kprintf("wqtest: FAILED (%d errors)\n", failures);
+	}
+	else {
+		kprintf("wqtest: passed.\n");
+	}
+	workqueue_stats(false);
+	return failures ? EIO : 0;
+}
@@ -33,8 +33,10 @@
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
+#include <threadlist.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
+#include <rcu.h>
 
 /*
  * Time handling.
@@ -53,25 +55,50 @@
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
-
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-/*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
- */
-static struct wchan *minibolt;
+#define QUANTUM_HARDCLOCKS	4	/* Preempt a lone thread every 4. */
 
 /* 
- * number of minibolts per second
+ * number of timerclock ticks per second
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+#define MINI_PER_SECOND (1000000/LT_GRANULARITY)
 
 /*
- * minibolt countdown
+ * Timed sleeps.
+ *
+ * Threads sleeping until a particular timerclock tick are kept in a
+ * hashed timer wheel: TIMER_WHEEL_SLOTS slots, indexed by expiry tick
+ * modulo the wheel size, each with its own list of sleepers and its
+ * own wait channel. On each tick timerclock() looks only at the slot
+ * for that tick and wakes its channel only if something there has
+ * actually expired, so the cost per tick does not grow with the total
+ * number of sleepers. A sleeper more than one revolution out shares
+ * its slot with nearer ones; if it gets woken along with them it sees
+ * it hasn't expired and goes back to sleep.
+ *
+ * Sleeper records live on the sleeping thread's stack. Each slot
+ * also has a list of timeouts (see clock.h), hashed the same way.
+ * timer_lock protects the slot lists, the ts_expired and to_armed
+ * flags, and timer_ticks.
  */
-static int minicount;
+#define TIMER_WHEEL_SLOTS	64	/* must be a power of 2 */
+
+struct timer_sleeper {
+	uint64_t ts_expire;		/* tick at which to wake */
+	bool ts_expired;		/* set by timerclock() */
+	struct timer_sleeper *ts_next;	/* next in the same slot */
+};
+
+struct timer_slot {
+	struct timer_sleeper *tw_sleepers;
+	struct timeout *tw_timeouts;
+	struct wchan *tw_wchan;
+};
+
+static struct timer_slot timer_wheel[TIMER_WHEEL_SLOTS];
+static struct spinlock timer_lock = SPINLOCK_NAMED_INITIALIZER("timer");
+static uint64_t timer_ticks;
+static unsigned timer_subsec;		/* ticks into the current second */
+static volatile unsigned timer_uptime;	/* whole seconds since boot */
 
 /*
  * Setup.
@@ -79,17 +106,28 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
-	}
-	minicount = MINI_PER_SECOND;
+	unsigned i;
+
 	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	KASSERT(MINI_PER_SECOND > 0);
+
+	for (i=0; i<TIMER_WHEEL_SLOTS; i++) {
+		timer_wheel[i].tw_sleepers = NULL;
+		timer_wheel[i].tw_timeouts = NULL;
+		timer_wheel[i].tw_wchan = wchan_create("timer");
+		if (timer_wheel[i].tw_wchan == NULL) {
+			panic("Couldn't create timer wheel\n");
+		}
+	}
+	timer_ticks = 0;
+	timer_subsec = 0;
+	timer_uptime = 0;
+}
+
+unsigned
+clock_uptime(void)
+{
+	return timer_uptime;
 }
 
 /*
@@ -99,12 +137,68 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct timer_slot *slot;
+	struct timer_sleeper **tsp, *ts;
+	struct timeout **top, *to;
+	void (*func)(void *);
+	void *arg;
+	uint64_t now;
+	bool wake;
+
+	wake = false;
+
+	spinlock_acquire(&timer_lock);
+	now = ++timer_ticks;
+	if (++timer_subsec == MINI_PER_SECOND) {
+		timer_subsec = 0;
+		timer_uptime++;
+	}
+	slot = &timer_wheel[now & (TIMER_WHEEL_SLOTS - 1)];
+	tsp = &slot->tw_sleepers;
+	while ((ts = *tsp) != NULL) {
+		if (ts->ts_expire <= now) {
+			ts->ts_expired = true;
+			*tsp = ts->ts_next;
+			wake = true;
+		}
+		else {
+			tsp = &ts->ts_next;
+		}
+	}
+	spinlock_release(&timer_lock);
+
+	/*
+	 * Expired sleepers locked the channel before dropping
+	 * timer_lock, so they are already on it.
+	 */
+	if (wake) {
+		wchan_wakeall(slot->tw_wchan);
+	}
+
+	/*
+	 * Fire expired timeouts one at a time, without timer_lock
+	 * held, so they can rearm themselves. Once a timeout is
+	 * unlinked its owner may reuse it, so copy out the call first.
+	 */
+	while (1) {
+		spinlock_acquire(&timer_lock);
+		for (top = &slot->tw_timeouts; (to = *top) != NULL;
+		     top = &to->to_next) {
+			if (to->to_expire <= now) {
+				break;
+			}
+		}
+		if (to == NULL) {
+			spinlock_release(&timer_lock);
+			break;
+		}
+		*top = to->to_next;
+		to->to_armed = false;
+		func = to->to_func;
+		arg = to->to_arg;
+		spinlock_release(&timer_lock);
+
+		func(arg);
 	}
 }
 
@@ -120,13 +214,80 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+
+	/*
+	 * If we didn't interrupt an RCU read section, this cpu can't
+	 * be holding on to anything from before.
+	 */
+	if (curthread->t_rcu_nest == 0) {
+		rcu_quiescent();
+	}
+
+	/*
+	 * An idle cpu has nothing to reshuffle, nothing to push to
+	 * other cpus, and nothing to preempt; it will look for work
+	 * itself (see thread_steal) when it next comes out of
+	 * cpu_idle(). So don't bother.
+	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	thread_account_tick(curcpu->c_intr_user);
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+
+	/*
+	 * Only preempt the current thread if something else is
+	 * waiting to run here or its quantum is up. Peeking at the
+	 * run queue count without the lock is fine; if we miss a
+	 * thread being added right now, the next tick will see it.
+	 * Never preempt an RCU reader.
+	 */
+	if (curthread->t_rcu_nest > 0) {
+		return;
+	}
+	if (!threadlist_isempty(&curcpu->c_runqueue) ||
+	    curcpu->c_hardclocks - curcpu->c_quantum_start
+	    >= QUANTUM_HARDCLOCKS) {
+		thread_preempt();
+	}
+}
+
+/*
+ * Sleep for at least NTICKS timerclock ticks. We may be partway
+ * through the current tick, so that one doesn't count: wake on the
+ * (NTICKS+1)th tick boundary, not the NTICKS-th.
+ */
+static
+void
+timer_sleep(uint64_t nticks)
+{
+	struct timer_sleeper ts;
+	struct timer_slot *slot;
+
+	if (nticks == 0) {
+		return;
+	}
+
+	spinlock_acquire(&timer_lock);
+	ts.ts_expire = timer_ticks + nticks + 1;
+	ts.ts_expired = false;
+	slot = &timer_wheel[ts.ts_expire & (TIMER_WHEEL_SLOTS - 1)];
+	ts.ts_next = slot->tw_sleepers;
+	slot->tw_sleepers = &ts;
+
+	while (!ts.ts_expired) {
+		wchan_lock(slot->tw_wchan);
+		spinlock_release(&timer_lock);
+		wchan_sleep(slot->tw_wchan);
+		spinlock_acquire(&timer_lock);
+	}
+	spinlock_release(&timer_lock);
 }
 
 /*
@@ -135,11 +296,9 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		timer_sleep((uint64_t)num_secs * MINI_PER_SECOND);
+	}
 }
 
 /*
@@ -149,9 +308,86 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks > 0) {
+		timer_sleep(num_ticks);
+	}
+}
+
+/*
+ * Suspend execution for at least secs seconds plus nsecs
+ * nanoseconds, rounded up to a whole number of timer ticks.
+ */
+void
+clocknanosleep(time_t secs, uint32_t nsecs)
+{
+	timer_sleep(clock_ticks(secs, nsecs));
+}
+
+/*
+ * Convert secs plus nsecs to timer ticks, rounding up.
+ */
+uint64_t
+clock_ticks(time_t secs, uint32_t nsecs)
+{
+	uint64_t nticks;
+
+	KASSERT(secs >= 0);
+	KASSERT(nsecs < 1000000000);
+
+	nticks = (uint64_t)secs * MINI_PER_SECOND;
+	nticks += DIVROUNDUP(nsecs, LT_GRANULARITY * 1000);
+	return nticks;
+}
+
+/*
+ * Timeouts.
+ */
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_expire = 0;
+	to->to_armed = false;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_next = NULL;
+}
+
+void
+timeout_add(struct timeout *to, uint64_t nticks)
+{
+	struct timer_slot *slot;
+
+	KASSERT(nticks > 0);
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(!to->to_armed);
+	/* as in timer_sleep, the current partial tick doesn't count */
+	to->to_expire = timer_ticks + nticks + 1;
+	to->to_armed = true;
+	slot = &timer_wheel[to->to_expire & (TIMER_WHEEL_SLOTS - 1)];
+	to->to_next = slot->tw_timeouts;
+	slot->tw_timeouts = to;
+	spinlock_release(&timer_lock);
+}
+
+bool
+timeout_del(struct timeout *to)
+{
+	struct timer_slot *slot;
+	struct timeout **top;
+	bool was;
+
+	spinlock_acquire(&timer_lock);
+	was = to->to_armed;
+	if (was) {
+		slot = &timer_wheel[to->to_expire & (TIMER_WHEEL_SLOTS - 1)];
+		for (top = &slot->tw_timeouts; *top != to;
+		     top = &(*top)->to_next) {
+			KASSERT(*top != NULL);
+		}
+		*top = to->to_next;
+		to->to_armed = false;
+	}
+	spinlock_release(&timer_lock);
+	return was;
 }
@@ -0,0 +1,331 @@
+/*
+ * Lock contention profiling. See lockstat.h.
+ *
+ * The class table is a fixed open-addressed hash table, since classes
+ * are created from inside spinlock_acquire, where we can't kmalloc.
+ * For the same reason this file must not use the ordinary spinlock
+ * functions: the table and each class are guarded by a bare
+ * spinlock_data_t taken with interrupts off.
+ *
+ * Classes are never removed; "lockstat reset" only zeroes counters, so
+ * locks can keep their cached class pointers.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NCLASSES	256	/* power of 2 */
+#define LOCKSTAT_NAMELEN	24
+
+struct lockstat {
+	volatile spinlock_data_t ls_lock;
+	volatile bool ls_used;
+	int ls_kind;
+	const void *ls_pc;		/* key, if there's no name */
+	char ls_name[LOCKSTAT_NAMELEN];	/* key, truncated */
+
+	unsigned ls_acquires;
+	unsigned ls_contended;
+	uint64_t ls_waittotal;
+	uint64_t ls_waitmax;
+	uint64_t ls_holdtotal;
+	uint64_t ls_holdmax;
+};
+
+volatile bool lockstat_enabled;
+
+static struct lockstat lockstat_table[LOCKSTAT_NCLASSES];
+static struct lockstat lockstat_overflow;
+static volatile spinlock_data_t lockstat_table_lock = SPINLOCK_DATA_INITIALIZER;
+
+static const char *const lockstat_kinds[] = { "spin", "lock", "sem" };
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Raw locking for the table and the classes.
+ */
+static
+int
+lockstat_lock(volatile spinlock_data_t *sd)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockstat_unlock(volatile spinlock_data_t *sd, int spl)
+{
+	spinlock_data_set(sd, 0);
+	splx(spl);
+}
+
+/*
+ * Names are keyed on their first LOCKSTAT_NAMELEN-1 characters.
+ */
+static
+bool
+lockstat_namematch(const char *key, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN-1; i++) {
+		if (key[i] != name[i]) {
+			return false;
+		}
+		if (key[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+static
+bool
+lockstat_match(struct lockstat *ls, int kind, const char *name,
+	       const void *pc)
+{
+	if (!ls->ls_used || ls->ls_kind != kind) {
+		return false;
+	}
+	if (name == NULL) {
+		return ls->ls_name[0] == 0 && ls->ls_pc == pc;
+	}
+	return lockstat_namematch(ls->ls_name, name);
+}
+
+static
+unsigned
+lockstat_hash(int kind, const char *name, const void *pc)
+{
+	unsigned h, i;
+
+	h = kind;
+	if (name == NULL) {
+		h = h * 31 + (unsigned)(uintptr_t)pc / 4;
+	}
+	else {
+		for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+			h = h * 31 + (unsigned char)name[i];
+		}
+	}
+	return h;
+}
+
+struct lockstat *
+lockstat_lookup(int kind, const char *name, const void *pc)
+{
+	struct lockstat *ls;
+	unsigned h, i, j;
+	int spl;
+
+	h = lockstat_hash(kind, name, pc);
+
+	/* Look without the table lock; entries never move. */
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		ls = &lockstat_table[(h + i) & (LOCKSTAT_NCLASSES - 1)];
+		if (!ls->ls_used) {
+			break;
+		}
+		if (lockstat_match(ls, kind, name, pc)) {
+			return ls;
+		}
+	}
+
+	/* Not there; recheck and insert with the lock held. */
+	spl = lockstat_lock(&lockstat_table_lock);
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		ls = &lockstat_table[(h + i) & (LOCKSTAT_NCLASSES - 1)];
+		if (!ls->ls_used) {
+			ls->ls_kind = kind;
+			ls->ls_pc = pc;
+			ls->ls_name[0] = 0;
+			if (name != NULL) {
+				for (j=0; j<LOCKSTAT_NAMELEN-1 && name[j]; j++) {
+					ls->ls_name[j] = name[j];
+				}
+				ls->ls_name[j] = 0;
+			}
+			ls->ls_used = true;
+			lockstat_unlock(&lockstat_table_lock, spl);
+			return ls;
+		}
+		if (lockstat_match(ls, kind, name, pc)) {
+			lockstat_unlock(&lockstat_table_lock, spl);
+			return ls;
+		}
+	}
+	lockstat_unlock(&lockstat_table_lock, spl);
+	return &lockstat_overflow;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+void
+lockstat_acquired(struct lockstat *ls, bool contended,
+		  uint64_t start, uint64_t now)
+{
+	uint64_t wait;
+	int spl;
+
+	wait = now - start;
+	spl = lockstat_lock(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		ls->ls_waittotal += wait;
+		if (wait > ls->ls_waitmax) {
+			ls->ls_waitmax = wait;
+		}
+	}
+	lockstat_unlock(&ls->ls_lock, spl);
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64_t acqtime, uint64_t now)
+{
+	uint64_t hold;
+	int spl;
+
+	hold = now - acqtime;
+	spl = lockstat_lock(&ls->ls_lock);
+	ls->ls_holdtotal += hold;
+	if (hold > ls->ls_holdmax) {
+		ls->ls_holdmax = hold;
+	}
+	lockstat_unlock(&ls->ls_lock, spl);
+}
+
+////////////////////////////////////////////////////////////
+
+void
+lockstat_enable(bool on)
+{
+	lockstat_enabled = on;
+}
+
+static
+void
+lockstat_clear(struct lockstat *ls)
+{
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waittotal = 0;
+	ls->ls_waitmax = 0;
+	ls->ls_holdtotal = 0;
+	ls->ls_holdmax = 0;
+}
+
+/*
+ * Copy out one class under its lock, so the printing isn't done with
+ * anything held.
+ */
+static
+void
+lockstat_snap(struct lockstat *ls, struct lockstat *snap, bool reset)
+{
+	int spl;
+
+	spl = lockstat_lock(&ls->ls_lock);
+	*snap = *ls;
+	if (reset) {
+		lockstat_clear(ls);
+	}
+	lockstat_unlock(&ls->ls_lock, spl);
+	spinlock_data_set(&snap->ls_lock, 0);
+}
+
+void
+lockstat_print(unsigned topn, bool reset)
+{
+	struct lockstat *snaps, *ls, tmp;
+	unsigned i, j, n, best;
+	char namebuf[LOCKSTAT_NAMELEN];
+	const char *name;
+
+	snaps = kmalloc((LOCKSTAT_NCLASSES + 1) * sizeof(*snaps));
+	if (snaps == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+
+	n = 0;
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		if (lockstat_table[i].ls_used) {
+			lockstat_snap(&lockstat_table[i], &snaps[n++], reset);
+		}
+	}
+	lockstat_snap(&lockstat_overflow, &snaps[n], reset);
+	if (snaps[n].ls_acquires > 0) {
+		snaps[n].ls_used = true;
+		snaps[n].ls_kind = LOCKSTAT_SPIN;
+		strcpy(snaps[n].ls_name, "(table full)");
+		n++;
+	}
+
+	/* Partial selection sort by total wait, then contended count. */
+	if (topn > n) {
+		topn = n;
+	}
+	for (i=0; i<topn; i++) {
+		best = i;
+		for (j=i+1; j<n; j++) {
+			if (snaps[j].ls_waittotal > snaps[best].ls_waittotal ||
+			    (snaps[j].ls_waittotal == snaps[best].ls_waittotal &&
+			     snaps[j].ls_contended > snaps[best].ls_contended)) {
+				best = j;
+			}
+		}
+		if (best != i) {
+			tmp = snaps[i];
+			snaps[i] = snaps[best];
+			snaps[best] = tmp;
+		}
+	}
+
+	kprintf("lockstat: %s, %u classes, times in usec\n",
+		lockstat_enabled ? "on" : "off", n);
+	kprintf("kind name                      acquires contended"
+		"   wait tot   wait max   hold tot   hold max\n");
+	for (i=0; i<topn; i++) {
+		ls = &snaps[i];
+		if (ls->ls_name[0] != 0) {
+			name = ls->ls_name;
+		}
+		else {
+			snprintf(namebuf, sizeof(namebuf), "@%p", ls->ls_pc);
+			name = namebuf;
+		}
+		kprintf("%-4s %-23s %10u %9u %10lu %10lu %10lu %10lu\n",
+			lockstat_kinds[ls->ls_kind], name,
+			ls->ls_acquires, ls->ls_contended,
+			(unsigned long)(ls->ls_waittotal / 1000),
+			(unsigned long)(ls->ls_waitmax / 1000),
+			(unsigned long)(ls->ls_holdtotal / 1000),
+			(unsigned long)(ls->ls_holdmax / 1000));
+	}
+	if (reset) {
+		kprintf("lockstat: counters cleared\n");
+	}
+
+	kfree(snaps);
+}
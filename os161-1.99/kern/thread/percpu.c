@@ -0,0 +1,106 @@
+/*
+ * Per-cpu event counters. See percpu.h.
+ *
+ * The registration list only ever grows, and entries are fully set
+ * up before they are linked in, so it is walked without the lock.
+ */
+
+#define PERCPU_INLINE
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <percpu.h>
+
+/* Show per-cpu columns for at most this many cpus. */
+#define PERCPU_PRINTCPUS	8
+
+static struct spinlock percpu_lock = SPINLOCK_NAMED_INITIALIZER("percpu");
+static struct percpu_counter *percpu_head;
+static struct percpu_counter **percpu_tailp = &percpu_head;
+
+void
+percpu_counter_register(struct percpu_counter *pc)
+{
+	spinlock_acquire(&percpu_lock);
+	if (!pc->pc_registered) {
+		pc->pc_next = NULL;
+		*percpu_tailp = pc;
+		percpu_tailp = &pc->pc_next;
+		pc->pc_registered = true;
+	}
+	spinlock_release(&percpu_lock);
+}
+
+/*
+ * One cpu's count since the last reset. Unsigned subtraction makes
+ * this come out right across a wrap of the slot.
+ */
+static
+unsigned
+percpu_counter_slot(struct percpu_counter *pc, unsigned cpunum)
+{
+	return pc->pc_count[cpunum] - pc->pc_base[cpunum];
+}
+
+uint64_t
+percpu_counter_read(struct percpu_counter *pc)
+{
+	uint64_t total;
+	unsigned i, n;
+
+	n = cpu_count();
+	total = 0;
+	for (i=0; i<n; i++) {
+		total += percpu_counter_slot(pc, i);
+	}
+	return total;
+}
+
+void
+percpu_counter_reset(struct percpu_counter *pc)
+{
+	unsigned i, n;
+
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		pc->pc_base[i] = pc->pc_count[i];
+	}
+}
+
+void
+percpu_counters_print(bool reset)
+{
+	struct percpu_counter *pc;
+	unsigned i, ncpus;
+	bool percpu;
+
+	ncpus = cpu_count();
+	percpu = ncpus > 1 && ncpus <= PERCPU_PRINTCPUS;
+
+	kprintf("%-24s %12s", "counter", "total");
+	if (percpu) {
+		for (i=0; i<ncpus; i++) {
+			kprintf("      cpu%u", i);
+		}
+	}
+	kprintf("\n");
+
+	for (pc = percpu_head; pc != NULL; pc = pc->pc_next) {
+		kprintf("%-24s %12llu", pc->pc_name,
+			(unsigned long long)percpu_counter_read(pc));
+		if (percpu) {
+			for (i=0; i<ncpus; i++) {
+				kprintf(" %9u",
+					percpu_counter_slot(pc, i));
+			}
+		}
+		kprintf("\n");
+		if (reset) {
+			percpu_counter_reset(pc);
+		}
+	}
+	if (reset) {
+		kprintf("counters: reset\n");
+	}
+}
@@ -0,0 +1,208 @@
+/*
+ * Read-copy-update. See rcu.h.
+ *
+ * Grace periods are numbered. A grace period starts when there are
+ * callbacks waiting and none is in progress; it ends when every CPU
+ * has reported a quiescent state since it started, which each CPU
+ * notes by copying rcu_gp_started into its c_rcu_gp. Callbacks queued
+ * while a grace period is in progress wait for the next one, since
+ * some CPUs may have reported before the object was retired.
+ *
+ * Everything below is protected by rcu_lock, except that
+ * rcu_quiescent peeks at rcu_gp_started without it so that the
+ * common case (nothing to report) is just a compare.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <rcu.h>
+
+static struct spinlock rcu_lock = SPINLOCK_NAMED_INITIALIZER("rcu");
+
+static volatile unsigned rcu_gp_started;	/* last grace period begun */
+static unsigned rcu_gp_done;			/* last grace period ended */
+static unsigned rcu_cpus_left;			/* cpus yet to report */
+static unsigned rcu_ncpus;			/* 0 until bootstrapped */
+
+/* Callback queues: queued for the next grace period, for the current
+   one, and ready to run. Each is a singly linked list with a tail. */
+struct rcu_queue {
+	struct rcu_head *rq_head;
+	struct rcu_head **rq_tail;
+};
+static struct rcu_queue rcu_next, rcu_wait, rcu_ready;
+
+static struct semaphore *rcu_kick;
+
+static
+void
+rcu_queue_init(struct rcu_queue *q)
+{
+	q->rq_head = NULL;
+	q->rq_tail = &q->rq_head;
+}
+
+/*
+ * Move everything on FROM onto the end of TO.
+ */
+static
+void
+rcu_queue_splice(struct rcu_queue *from, struct rcu_queue *to)
+{
+	if (from->rq_head == NULL) {
+		return;
+	}
+	*to->rq_tail = from->rq_head;
+	to->rq_tail = from->rq_tail;
+	rcu_queue_init(from);
+}
+
+/*
+ * Start a grace period for the callbacks on rcu_next, if there are
+ * any and none is in progress. Call with rcu_lock held.
+ */
+static
+void
+rcu_gp_start(void)
+{
+	if (rcu_gp_started != rcu_gp_done || rcu_next.rq_head == NULL) {
+		return;
+	}
+	rcu_queue_splice(&rcu_next, &rcu_wait);
+	rcu_cpus_left = rcu_ncpus;
+	rcu_gp_started++;
+}
+
+void
+rcu_quiescent(void)
+{
+	struct cpu *c;
+	bool kick = false;
+
+	c = curcpu->c_self;
+	if (rcu_ncpus == 0 || c->c_rcu_gp == rcu_gp_started) {
+		return;
+	}
+
+	spinlock_acquire(&rcu_lock);
+	if (c->c_rcu_gp != rcu_gp_started) {
+		c->c_rcu_gp = rcu_gp_started;
+		KASSERT(rcu_cpus_left > 0);
+		rcu_cpus_left--;
+		if (rcu_cpus_left == 0) {
+			rcu_gp_done = rcu_gp_started;
+			rcu_queue_splice(&rcu_wait, &rcu_ready);
+			rcu_gp_start();
+			kick = true;
+		}
+	}
+	spinlock_release(&rcu_lock);
+
+	if (kick) {
+		V(rcu_kick);
+	}
+}
+
+void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+	KASSERT(rcu_ncpus > 0);
+
+	head->rh_func = func;
+	head->rh_next = NULL;
+
+	spinlock_acquire(&rcu_lock);
+	*rcu_next.rq_tail = head;
+	rcu_next.rq_tail = &head->rh_next;
+	rcu_gp_start();
+	spinlock_release(&rcu_lock);
+}
+
+/*
+ * synchronize_rcu is call_rcu with a callback that wakes us up.
+ */
+struct rcu_sync {
+	struct rcu_head rs_head;	/* must be first */
+	struct semaphore *rs_sem;
+};
+
+static
+void
+rcu_sync_done(struct rcu_head *head)
+{
+	struct rcu_sync *rs = (struct rcu_sync *)head;
+
+	V(rs->rs_sem);
+}
+
+void
+synchronize_rcu(void)
+{
+	struct rcu_sync rs;
+
+	KASSERT(curthread->t_rcu_nest == 0);
+
+	rs.rs_sem = sem_create("synchronize_rcu", 0);
+	if (rs.rs_sem == NULL) {
+		panic("synchronize_rcu: out of memory\n");
+	}
+	call_rcu(&rs.rs_head, rcu_sync_done);
+	P(rs.rs_sem);
+	sem_destroy(rs.rs_sem);
+}
+
+/*
+ * The callback thread. Callbacks can do whatever a thread can, so
+ * they're run here rather than from the quiescent-state hooks.
+ */
+static
+void
+rcu_thread(void *junk, unsigned long junk2)
+{
+	struct rcu_head *head, *next;
+
+	(void)junk;
+	(void)junk2;
+
+	while (1) {
+		P(rcu_kick);
+
+		spinlock_acquire(&rcu_lock);
+		head = rcu_ready.rq_head;
+		rcu_queue_init(&rcu_ready);
+		spinlock_release(&rcu_lock);
+
+		for (; head != NULL; head = next) {
+			next = head->rh_next;
+			head->rh_func(head);
+		}
+	}
+}
+
+void
+rcu_bootstrap(void)
+{
+	int result;
+
+	rcu_queue_init(&rcu_next);
+	rcu_queue_init(&rcu_wait);
+	rcu_queue_init(&rcu_ready);
+
+	rcu_kick = sem_create("rcu", 0);
+	if (rcu_kick == NULL) {
+		panic("rcu_bootstrap: out of memory\n");
+	}
+	result = thread_fork("rcu", NULL, rcu_thread, NULL, 0);
+	if (result) {
+		panic("rcu_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+
+	spinlock_acquire(&rcu_lock);
+	rcu_ncpus = cpu_count();
+	spinlock_release(&rcu_lock);
+}
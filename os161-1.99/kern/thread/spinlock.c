@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,6 +51,38 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+	spinlock_data_set(&lk->lk_next, 0);
+	lk->lk_fair = false;
+#if OPT_LOCKSTAT
+	lk->lk_name = NULL;
+	lk->lk_stat = NULL;
+	lk->lk_acqtime = 0;
+#endif
+}
+
+/*
+ * Initialize a ticket spinlock.
+ */
+void
+spinlock_init_fair(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_fair = true;
+}
+
+/*
+ * Give the lock a lockstat class name.
+ */
+void
+spinlock_setname(struct spinlock *lk, const char *name)
+{
+#if OPT_LOCKSTAT
+	lk->lk_name = name;
+	lk->lk_stat = NULL;
+#else
+	(void)lk;
+	(void)name;
+#endif
 }
 
 /*
@@ -59,7 +92,13 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	if (lk->lk_fair) {
+		KASSERT(spinlock_data_get(&lk->lk_lock) ==
+			spinlock_data_get(&lk->lk_next));
+	}
+	else {
+		KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	}
 }
 
 /*
@@ -73,6 +112,11 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKSTAT
+	uint64_t start = 0;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +131,73 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (lk->lk_fair) {
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Ticket lock: take a number, then wait until it's
+		 * being served. The fetch-and-add is the only atomic
+		 * operation; after that we spin on plain loads, and
+		 * only the holder ever stores to lk_lock.
 		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+		while (spinlock_data_get(&lk->lk_lock) != ticket) {
+#if OPT_LOCKSTAT
+			if (!contended && lockstat_enabled) {
+				contended = true;
+				start = lockstat_now();
+			}
+#endif
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first before
+			 * doing test-and-set, to reduce bus contention.
+			 *
+			 * Test-and-set is a machine-level atomic operation
+			 * that writes 1 into the lock word and returns the
+			 * previous value. If that value was 0, the lock was
+			 * previously unheld and we now own it. If it was 1,
+			 * we don't.
+			 */
+			if (spinlock_data_get(&lk->lk_lock) != 0) {
+				goto busy;
+			}
+			if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+				goto busy;
+			}
+			break;
+		busy:
+#if OPT_LOCKSTAT
+			if (!contended && lockstat_enabled) {
+				contended = true;
+				start = lockstat_now();
+			}
+#endif
 			continue;
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	lk->lk_acqtime = 0;
+	if (lockstat_enabled) {
+		/* unnamed locks are classed by where they're taken */
+		if (lk->lk_name == NULL) {
+			lk->lk_stat = lockstat_lookup(LOCKSTAT_SPIN, NULL,
+					__builtin_return_address(0));
+		}
+		else if (lk->lk_stat == NULL) {
+			lk->lk_stat = lockstat_lookup(LOCKSTAT_SPIN,
+						      lk->lk_name, NULL);
+		}
+		lk->lk_acqtime = lockstat_now();
+		lockstat_acquired(lk->lk_stat, contended,
+				  contended ? start : lk->lk_acqtime,
+				  lk->lk_acqtime);
+	}
+#endif
 }
 
 /*
@@ -121,8 +211,23 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	if (lk->lk_acqtime != 0) {
+		lockstat_released(lk->lk_stat, lk->lk_acqtime,
+				  lockstat_now());
+		lk->lk_acqtime = 0;
+	}
+#endif
+
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_fair) {
+		/* serve the next ticket */
+		spinlock_data_set(&lk->lk_lock,
+				  spinlock_data_get(&lk->lk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -40,6 +40,8 @@
 #include <current.h>
 #include <synch.h>
 #include <cpu.h>
+#include <lockstat.h>
+#include <percpu.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,7 +73,11 @@ sem_create(const char *name, int initial_count)
 	}
 
 	spinlock_init(&sem->sem_lock);
+	spinlock_setname(&sem->sem_lock, sem->sem_name);
         sem->sem_count = initial_count;
+#if OPT_LOCKSTAT
+        sem->sem_stat = lockstat_lookup(LOCKSTAT_SEM, sem->sem_name, NULL);
+#endif
 
         return sem;
 }
@@ -91,6 +97,11 @@ sem_destroy(struct semaphore *sem)
 void 
 P(struct semaphore *sem)
 {
+#if OPT_LOCKSTAT
+        uint64_t start;
+        bool contended = false;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -101,8 +112,15 @@ P(struct semaphore *sem)
          */
         KASSERT(curthread->t_in_interrupt == false);
 
+#if OPT_LOCKSTAT
+        start = lockstat_enabled ? lockstat_now() : 0;
+#endif
+
 	spinlock_acquire(&sem->sem_lock);
         while (sem->sem_count == 0) {
+#if OPT_LOCKSTAT
+                contended = true;
+#endif
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
 		 * along in V right this instant the wakeup can't go
@@ -128,6 +146,13 @@ P(struct semaphore *sem)
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
+
+#if OPT_LOCKSTAT
+        if (start != 0) {
+                lockstat_acquired(sem->sem_stat, contended, start,
+                                  lockstat_now());
+        }
+#endif
 }
 
 void
@@ -165,7 +190,15 @@ lock_create(const char *name)
         }
 
         lock->locked = false;
+        lock->lk_owner = NULL;
         lock->lk_holder = NULL;
+        lock->lk_piwaiters = NULL;
+        lock->lk_piowner = NULL;
+        lock->lk_pinext = NULL;
+        lock->lk_acquires = 0;
+        lock->lk_contended = 0;
+        lock->lk_spinwins = 0;
+        lock->lk_sleeps = 0;
 
         lock->lk_wchan = wchan_create(lock->lk_name);
 
@@ -176,6 +209,11 @@ lock_create(const char *name)
         }
 
         spinlock_init(&lock->lk_spinlock);
+        spinlock_setname(&lock->lk_spinlock, lock->lk_name);
+#if OPT_LOCKSTAT
+        lock->lk_stat = lockstat_lookup(LOCKSTAT_SLEEP, lock->lk_name, NULL);
+        lock->lk_acqtime = 0;
+#endif
 
         return lock;
 }
@@ -184,41 +222,344 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+        KASSERT(lock->lk_owner == NULL);
+        KASSERT(lock->lk_piwaiters == NULL);
 
-        // add stuff here as needed
         spinlock_cleanup(&lock->lk_spinlock);
         wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Spin budget for a contended acquire, in polls of the lock word.
+ * Each poll is a handful of loads, so the default is a few tens of
+ * microseconds on sys161 - about what a short critical section costs,
+ * and well under the cost of two context switches.
+ */
+#define LOCK_SPIN_DEFAULT 1000
+
+static unsigned lock_spinmax = LOCK_SPIN_DEFAULT;
+
+/*
+ * System-wide totals, only touched on the contended path.
+ */
+static PERCPU_COUNTER(lock_stat_contended, "lock_contended");
+static PERCPU_COUNTER(lock_stat_spinwins, "lock_spinwins");
+static PERCPU_COUNTER(lock_stat_spins, "lock_spinpolls");
+static PERCPU_COUNTER(lock_stat_sleeps, "lock_sleeps");
+
+/*
+ * Priority inheritance.
+ *
+ * All the inheritance links (t_waitlock, t_piwaitnext, t_pilocks,
+ * t_inherit, lk_piwaiters, lk_piowner, lk_pinext) are protected by
+ * pi_lock, so a chain of owners can be followed without taking each
+ * lock's spinlock. The order is lk_spinlock, then pi_lock, then the
+ * scheduler's lock inside thread_inherit.
+ *
+ * Only threads that go to sleep donate; a spinner's owner is already
+ * running. PI_MAXDEPTH bounds the walk in case of a deadlock cycle.
+ */
+#define PI_MAXDEPTH 16
+
+static struct spinlock pi_lock = SPINLOCK_NAMED_INITIALIZER("pi");
+static volatile bool lock_pi_enabled = true;
+
+static
+unsigned
+pi_effective(struct thread *t)
+{
+        return t->t_tickets > t->t_inherit ? t->t_tickets : t->t_inherit;
+}
+
+/*
+ * Pass T's effective share down the chain of owners it's waiting
+ * behind, stopping where it would make no difference.
+ */
+static
+void
+pi_propagate(struct thread *t)
+{
+        struct thread *owner;
+        unsigned prio, depth;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        prio = pi_effective(t);
+        for (depth = 0; depth < PI_MAXDEPTH; depth++) {
+                if (t->t_waitlock == NULL) {
+                        break;
+                }
+                owner = t->t_waitlock->lk_piowner;
+                if (owner == NULL || pi_effective(owner) >= prio) {
+                        break;
+                }
+                thread_inherit(owner, prio);
+                t = owner;
+        }
+}
+
+/*
+ * Recompute what T inherits from the sleepers on the locks it holds.
+ */
+static
+void
+pi_recompute(struct thread *t)
+{
+        struct lock *l;
+        struct thread *w;
+        unsigned prio = 0;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        for (l = t->t_pilocks; l != NULL; l = l->lk_pinext) {
+                for (w = l->lk_piwaiters; w != NULL; w = w->t_piwaitnext) {
+                        if (pi_effective(w) > prio) {
+                                prio = pi_effective(w);
+                        }
+                }
+        }
+        if (prio != t->t_inherit) {
+                thread_inherit(t, prio);
+        }
+}
+
+/*
+ * Make T the inheritance owner of LOCK.
+ */
+static
+void
+pi_setowner(struct lock *lock, struct thread *t)
+{
+        KASSERT(lock->lk_piowner == NULL);
+        lock->lk_piowner = t;
+        lock->lk_pinext = t->t_pilocks;
+        t->t_pilocks = lock;
+}
+
+static
+void
+pi_clearowner(struct lock *lock)
+{
+        struct lock **lp;
+
+        for (lp = &lock->lk_piowner->t_pilocks; *lp != lock;
+             lp = &(*lp)->lk_pinext) {
+                KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_pinext;
+        lock->lk_pinext = NULL;
+        lock->lk_piowner = NULL;
+}
+
+/*
+ * Called with LOCK's spinlock held, before going to sleep on it for
+ * the first time.
+ */
+static
+void
+pi_wait(struct lock *lock)
+{
+        spinlock_acquire(&pi_lock);
+        curthread->t_waitlock = lock;
+        curthread->t_piwaitnext = lock->lk_piwaiters;
+        lock->lk_piwaiters = curthread;
+        if (lock->lk_piowner == NULL) {
+                pi_setowner(lock, lock->lk_owner);
+        }
+        pi_propagate(curthread);
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Called with LOCK's spinlock held, just after getting it. WAITED
+ * says whether we went through pi_wait. If anyone else is still
+ * asleep on the lock, they now donate to us.
+ */
+static
+void
+pi_acquired(struct lock *lock, bool waited)
+{
+        struct thread **tp;
+
+        if (!waited && lock->lk_piwaiters == NULL) {
+                return;
+        }
+
+        spinlock_acquire(&pi_lock);
+        if (waited) {
+                for (tp = &lock->lk_piwaiters; *tp != curthread;
+                     tp = &(*tp)->t_piwaitnext) {
+                        KASSERT(*tp != NULL);
+                }
+                *tp = curthread->t_piwaitnext;
+                curthread->t_piwaitnext = NULL;
+                curthread->t_waitlock = NULL;
+        }
+        if (lock->lk_piwaiters != NULL) {
+                pi_setowner(lock, curthread);
+                pi_recompute(curthread);
+        }
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Called with LOCK's spinlock held, when releasing it: give back
+ * whatever its sleepers donated.
+ */
+static
+void
+pi_released(struct lock *lock)
+{
+        if (lock->lk_piowner == NULL) {
+                return;
+        }
+
+        spinlock_acquire(&pi_lock);
+        KASSERT(lock->lk_piowner == curthread);
+        pi_clearowner(lock);
+        pi_recompute(curthread);
+        spinlock_release(&pi_lock);
+}
+
+void
+lock_pi_enable(bool on)
+{
+        lock_pi_enabled = on;
+}
+
+/*
+ * Return true if it is worth spinning on LOCK: it is held by a thread
+ * that is currently on some other CPU. We never dereference lk_owner,
+ * since the owner can release the lock and exit under us; instead we
+ * check whether the CPU it acquired on is still running it.
+ */
+static
+bool
+lock_owner_running(struct lock *lock)
+{
+        struct thread *owner;
+        struct cpu *c;
+
+        owner = lock->lk_owner;
+        c = lock->lk_holder;
+        if (owner == NULL || c == NULL || c == curcpu->c_self) {
+                return false;
+        }
+        return c->c_curthread == owner && !c->c_isidle;
+}
+
+/*
+ * Busy-wait for LOCK to be released while its owner keeps running
+ * elsewhere. Returns the number of polls made; the caller retries
+ * the acquire either way.
+ */
+static
+unsigned
+lock_spin(struct lock *lock)
+{
+        unsigned spins;
+
+        for (spins = 0; spins < lock_spinmax; spins++) {
+                if (!lock->locked || !lock_owner_running(lock)) {
+                        break;
+                }
+        }
+        return spins;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-                
+        bool spun = false, slept = false, waited = false;
+        unsigned spins = 0;
+#if OPT_LOCKSTAT
+        uint64_t start;
+#endif
+
+        KASSERT(lock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(lock->lk_owner != curthread);
+
+#if OPT_LOCKSTAT
+        start = lockstat_enabled ? lockstat_now() : 0;
+#endif
 
         spinlock_acquire(&lock->lk_spinlock);
         while (lock->locked) {
+                /* spin at most once per acquire, then sleep */
+                if (!spun && lock_spinmax > 0 && lock_owner_running(lock)) {
+                        spun = true;
+                        spinlock_release(&lock->lk_spinlock);
+                        spins = lock_spin(lock);
+                        spinlock_acquire(&lock->lk_spinlock);
+                        continue;
+                }
+                lock->lk_sleeps++;
+                slept = true;
+                if (!waited && lock_pi_enabled) {
+                        pi_wait(lock);
+                        waited = true;
+                }
                 wchan_lock(lock->lk_wchan);
                 spinlock_release(&lock->lk_spinlock);
                 wchan_sleep(lock->lk_wchan);
                 spinlock_acquire(&lock->lk_spinlock);
         }
 
-
         lock->locked = true;
+        lock->lk_owner = curthread;
         lock->lk_holder = curcpu->c_self;
+        pi_acquired(lock, waited);
+        lock->lk_acquires++;
+        if (spun || slept) {
+                lock->lk_contended++;
+                if (!slept) {
+                        lock->lk_spinwins++;
+                }
+        }
+#if OPT_LOCKSTAT
+        lock->lk_acqtime = 0;
+        if (start != 0) {
+                lock->lk_acqtime = lockstat_now();
+                lockstat_acquired(lock->lk_stat, spun || slept, start,
+                                  lock->lk_acqtime);
+        }
+#endif
         spinlock_release(&lock->lk_spinlock);
 
+        if (spun || slept) {
+                percpu_counter_inc(&lock_stat_contended);
+                percpu_counter_add(&lock_stat_spins, spins);
+                if (slept) {
+                        percpu_counter_inc(&lock_stat_sleeps);
+                }
+                else {
+                        percpu_counter_inc(&lock_stat_spinwins);
+                }
+        }
 }
 
 void
 lock_release(struct lock *lock)
 {
+        KASSERT(lock != NULL);
+
         spinlock_acquire(&lock->lk_spinlock);
+#if OPT_LOCKSTAT
+        if (lock->lk_acqtime != 0) {
+                lockstat_released(lock->lk_stat, lock->lk_acqtime,
+                                  lockstat_now());
+                lock->lk_acqtime = 0;
+        }
+#endif
+        pi_released(lock);
+        lock->lk_owner = NULL;
         lock->lk_holder = NULL;
         lock->locked = false;
         spinlock_release(&lock->lk_spinlock);
+        /* spinners see locked go false; sleepers need a wakeup */
         wchan_wakeone(lock->lk_wchan);
 }
 
@@ -229,9 +570,53 @@ lock_do_i_hold(struct lock *lock)
                 return true;
         }
 
-        /* Assume we can read lk_holder atomically enough for this to work */
-        return (lock->lk_holder == curcpu->c_self);
+        /* Assume we can read lk_owner atomically enough for this to work */
+        return (lock->lk_owner == curthread);
+}
+
+void
+lock_spin_tune(unsigned maxspins)
+{
+        lock_spinmax = maxspins;
+}
+
+void
+lock_spin_stats(bool reset)
+{
+        unsigned contended, spinwins, spins, sleeps;
+
+        contended = percpu_counter_read(&lock_stat_contended);
+        spinwins = percpu_counter_read(&lock_stat_spinwins);
+        spins = percpu_counter_read(&lock_stat_spins);
+        sleeps = percpu_counter_read(&lock_stat_sleeps);
+        if (reset) {
+                percpu_counter_reset(&lock_stat_contended);
+                percpu_counter_reset(&lock_stat_spinwins);
+                percpu_counter_reset(&lock_stat_spins);
+                percpu_counter_reset(&lock_stat_sleeps);
+        }
 
+        kprintf("Adaptive locks: spin budget %u polls\n", lock_spinmax);
+        kprintf("contended acquires: %u\n", contended);
+        kprintf("  won by spinning:  %u (%u polls)\n", spinwins, spins);
+        kprintf("  went to sleep:    %u\n", sleeps);
+}
+
+void
+lock_print_stats(struct lock *lock)
+{
+        unsigned acquires, contended, spinwins, sleeps;
+
+        spinlock_acquire(&lock->lk_spinlock);
+        acquires = lock->lk_acquires;
+        contended = lock->lk_contended;
+        spinwins = lock->lk_spinwins;
+        sleeps = lock->lk_sleeps;
+        spinlock_release(&lock->lk_spinlock);
+
+        kprintf("Lock %s: %u acquires, %u contended, %u won by spinning, "
+                "%u sleeps\n", lock->lk_name, acquires, contended, spinwins,
+                sleeps);
 }
 
 
@@ -267,6 +652,7 @@ cv_create(const char *name)
         }
 
         spinlock_init(&cv->cv_spinlock);
+        spinlock_setname(&cv->cv_spinlock, cv->cv_name);
         
         return cv;
 }
@@ -329,3 +715,178 @@ cv_broadcast(struct cv *cv, struct lock *lock)
        return;
 
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_rwchan = wchan_create(rw->rw_name);
+        if (rw->rw_rwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_wwchan = wchan_create(rw->rw_name);
+        if (rw->rw_wwchan == NULL) {
+                wchan_destroy(rw->rw_rwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_spinlock);
+        spinlock_setname(&rw->rw_spinlock, rw->rw_name);
+        rw->rw_readers = 0;
+        rw->rw_writer = NULL;
+        rw->rw_waitreaders = 0;
+        rw->rw_waitwriters = 0;
+        rw->rw_rgen = 0;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitreaders == 0);
+        KASSERT(rw->rw_waitwriters == 0);
+
+        spinlock_cleanup(&rw->rw_spinlock);
+        wchan_destroy(rw->rw_wwchan);
+        wchan_destroy(rw->rw_rwchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        unsigned gen;
+
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_spinlock);
+        KASSERT(rw->rw_writer != curthread);
+        if (rw->rw_writer == NULL && rw->rw_waitwriters == 0) {
+                /* fast path: just count ourselves in */
+                rw->rw_readers++;
+                spinlock_release(&rw->rw_spinlock);
+                return;
+        }
+
+        /*
+         * Queue up. The releasing writer counts us into rw_readers
+         * and bumps rw_rgen before waking us, so when we see the
+         * generation change we already hold the lock.
+         */
+        rw->rw_waitreaders++;
+        gen = rw->rw_rgen;
+        while (rw->rw_rgen == gen) {
+                wchan_lock(rw->rw_rwchan);
+                spinlock_release(&rw->rw_spinlock);
+                wchan_sleep(rw->rw_rwchan);
+                spinlock_acquire(&rw->rw_spinlock);
+        }
+        spinlock_release(&rw->rw_spinlock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        bool wakewriter;
+
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_spinlock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+        rw->rw_readers--;
+        wakewriter = rw->rw_readers == 0 && rw->rw_waitwriters > 0;
+        spinlock_release(&rw->rw_spinlock);
+
+        if (wakewriter) {
+                wchan_wakeone(rw->rw_wwchan);
+        }
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_spinlock);
+        KASSERT(rw->rw_writer != curthread);
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                rw->rw_waitwriters++;
+                wchan_lock(rw->rw_wwchan);
+                spinlock_release(&rw->rw_spinlock);
+                wchan_sleep(rw->rw_wwchan);
+                spinlock_acquire(&rw->rw_spinlock);
+                rw->rw_waitwriters--;
+        }
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_spinlock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        bool wakereaders = false, wakewriter = false;
+
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_spinlock);
+        KASSERT(rw->rw_writer == curthread);
+        KASSERT(rw->rw_readers == 0);
+        rw->rw_writer = NULL;
+        if (rw->rw_waitreaders > 0) {
+                /* hand off to every reader queued behind us */
+                rw->rw_readers = rw->rw_waitreaders;
+                rw->rw_waitreaders = 0;
+                rw->rw_rgen++;
+                wakereaders = true;
+        }
+        else if (rw->rw_waitwriters > 0) {
+                wakewriter = true;
+        }
+        spinlock_release(&rw->rw_spinlock);
+
+        if (wakereaders) {
+                wchan_wakeall(rw->rw_rwchan);
+        }
+        else if (wakewriter) {
+                wchan_wakeone(rw->rw_wwchan);
+        }
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        if (!CURCPU_EXISTS()) {
+                return true;
+        }
+
+        return (rw->rw_writer == curthread);
+}
@@ -46,6 +46,8 @@
 #include <threadprivate.h>
 #include <proc.h>
 #include <current.h>
+#include <rcu.h>
+#include <percpu.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
@@ -72,6 +74,18 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Stride scheduling. STRIDE1 is the pass increment per hardclock for
+ * a thread holding one ticket. sched_nstride counts SCHED_STRIDE
+ * threads in existence; while it is zero the run queue is plain FIFO.
+ */
+#define STRIDE1 (1U << 20)
+static struct spinlock sched_lock = SPINLOCK_NAMED_INITIALIZER("sched");
+static volatile unsigned sched_nstride;
+
+static bool thread_steal(void);
+static void thread_reap(void *junk);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -142,7 +156,26 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_pinned = false;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
+	thread->t_loadas = NULL;
+	thread->t_lastcpu = NULL;
+	thread->t_lastrun = 0;
+	thread->t_schedclass = SCHED_RR;
+	thread->t_tickets = STRIDE_DEFAULT_TICKETS;
+	thread->t_stride = STRIDE1 / STRIDE_DEFAULT_TICKETS;
+	thread->t_pass = 0;
+	thread->t_inherit = 0;
+	thread->t_waitlock = NULL;
+	thread->t_piwaitnext = NULL;
+	thread->t_pilocks = NULL;
+	thread->t_rcu_nest = 0;
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	thread->t_preempting = false;
+	thread->t_cpuwin = 0;
+	thread->t_cpunow = 0;
+	thread->t_cpuprev = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -180,19 +213,33 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_switches = 0;
+	c->c_quantum_start = 0;
+	c->c_rcu_gp = 0;
+	c->c_intr_user = false;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	c->c_pass = 0;
+	spinlock_init_fair(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
+	c->c_migrate_out = 0;
+	c->c_migrate_warm = 0;
+	c->c_migrate_in = 0;
+	c->c_steals = 0;
+	workqueue_init(&c->c_workqueue);
+	work_init(&c->c_reapwork, thread_reap, NULL);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	KASSERT(c->c_number < PERCPU_MAXCPUS);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -227,6 +274,24 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Return the number of cpus created so far.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Return cpu number CPUNUM.
+ */
+struct cpu *
+cpu_get(unsigned cpunum)
+{
+	return cpuarray_get(&allcpus, cpunum);
+}
+
 /*
  * Destroy a thread.
  *
@@ -249,6 +314,14 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_waitlock == NULL);
+	KASSERT(thread->t_pilocks == NULL);
+	if (thread->t_schedclass == SCHED_STRIDE) {
+		spinlock_acquire(&sched_lock);
+		KASSERT(sched_nstride > 0);
+		sched_nstride--;
+		spinlock_release(&sched_lock);
+	}
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -266,19 +339,47 @@ thread_destroy(struct thread *thread)
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu. Freeing them is too much work to
+ * do on every context switch with interrupts off, so exorcise just
+ * pokes this cpu's work queue, and thread_reap does the job later in
+ * the (pinned, so same-cpu) worker thread.
  */
 static
 void
 exorcise(void)
 {
+	if (!threadlist_isempty(&curcpu->c_zombies)) {
+		workqueue_add(&curcpu->c_reapwork);
+	}
+}
+
+/*
+ * Work function to destroy this cpu's zombies. A context switch can
+ * add to the list, so detach it with interrupts off.
+ */
+static
+void
+thread_reap(void *junk)
+{
+	struct threadlist zombies;
 	struct thread *z;
+	int spl;
+
+	(void)junk;
 
+	threadlist_init(&zombies);
+	spl = splhigh();
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+		threadlist_addtail(&zombies, z);
+	}
+	splx(spl);
+
+	while ((z = threadlist_remhead(&zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
 		thread_destroy(z);
 	}
+	threadlist_cleanup(&zombies);
 }
 
 /*
@@ -426,6 +527,59 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * A thread is joining C's run queue, which must be locked. Don't let
+ * it bring along stride credit from a long sleep or from another cpu
+ * whose virtual time is behind ours, or it would monopolize the cpu
+ * until its pass caught up.
+ */
+static
+void
+thread_stride_join(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (t->t_pass < c->c_pass) {
+		t->t_pass = c->c_pass;
+	}
+}
+
+/*
+ * Choose the next thread to run from C's run queue, which must be
+ * locked, and remove it from the queue. Returns NULL if the queue is
+ * empty.
+ *
+ * In the normal round-robin case this is just the head of the queue.
+ * If stride scheduling is in use anywhere, it is instead the thread
+ * with the lowest pass; ties go to the one nearest the head, so equal
+ * shares still round-robin.
+ */
+static
+struct thread *
+thread_pick_next(struct cpu *c)
+{
+	struct thread *t, *best;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (sched_nstride == 0 || threadlist_isempty(&c->c_runqueue)) {
+		return threadlist_remhead(&c->c_runqueue);
+	}
+
+	best = NULL;
+	THREADLIST_FORALL(t, c->c_runqueue) {
+		if (best == NULL || t->t_pass < best->t_pass) {
+			best = t;
+		}
+	}
+	KASSERT(best != NULL);
+	threadlist_remove(&c->c_runqueue, best);
+	if (best->t_pass > c->c_pass) {
+		c->c_pass = best->t_pass;
+	}
+	return best;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,6 +604,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
+	thread_stride_join(targetcpu, target);
 	threadlist_addtail(&targetcpu->c_runqueue, target);
 	if (isidle) {
 		/*
@@ -464,6 +619,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+static PERCPU_COUNTER(thread_fork_count, "thread_fork");
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -471,14 +628,16 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It will start on CPU C, and
+ * stay there if PINNED is set.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_on(const char *name,
+	       struct proc *proc,
+	       struct cpu *c, bool pinned,
+	       void (*entrypoint)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -491,6 +650,7 @@ thread_fork(const char *name,
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
+	percpu_counter_inc(&thread_fork_count);
 
 	/* Allocate a stack */
 	newthread->t_stack = kmalloc(STACK_SIZE);
@@ -505,7 +665,20 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_cpu = c;
+	newthread->t_pinned = pinned;
+
+	/* Scheduling class and share */
+	newthread->t_tickets = curthread->t_tickets;
+	/* but not any share the parent has inherited */
+	newthread->t_stride = STRIDE1 / curthread->t_tickets;
+	newthread->t_pass = curthread->t_pass;
+	if (curthread->t_schedclass == SCHED_STRIDE) {
+		spinlock_acquire(&sched_lock);
+		newthread->t_schedclass = SCHED_STRIDE;
+		sched_nstride++;
+		spinlock_release(&sched_lock);
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,12 +701,74 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the target cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+/*
+ * Fork a thread that starts on the same CPU as the caller, unless
+ * the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_on(name, proc, curthread->t_cpu, false,
+			      entrypoint, data1, data2);
+}
+
+/*
+ * Fork a thread that lives on CPU CPUNUM.
+ */
+int
+thread_fork_pinned(const char *name,
+		   struct proc *proc,
+		   unsigned cpunum,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
+{
+	KASSERT(cpunum < cpuarray_num(&allcpus));
+
+	return thread_fork_on(name, proc, cpuarray_get(&allcpus, cpunum),
+			      true, entrypoint, data1, data2);
+}
+
+/*
+ * Fork a thread onto the least loaded cpu, counting each cpu's run
+ * queue plus the thread it's running, if any. The counts are read
+ * unlocked, as in thread_steal; they're only a hint. The search
+ * starts at the cpu after ours and ties go to the first one found,
+ * so a burst of forks fans out instead of piling onto cpu 0, and our
+ * own cpu is only picked if it is strictly the least busy.
+ */
+int
+thread_fork_spread(const char *name,
+		   struct proc *proc,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus, load, bestload;
+
+	numcpus = cpuarray_num(&allcpus);
+	best = NULL;
+	bestload = 0;
+	for (i=1; i<=numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		load = c->c_runqueue.tl_count + (c->c_isidle ? 0 : 1);
+		if (best == NULL || load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	return thread_fork_on(name, proc, best, false,
+			      entrypoint, data1, data2);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -553,6 +788,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
 
+	/* May not sleep or yield inside an RCU read section. */
+	KASSERT(curthread->t_rcu_nest == 0);
+
 	/* Explicitly disable interrupts on this processor */
 	spl = splhigh();
 
@@ -573,13 +811,31 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
+	/*
+	 * Micro-optimization: if nothing to do, just return. Give the
+	 * current thread a fresh quantum so hardclock doesn't keep
+	 * trying to preempt it on every tick.
+	 */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+		curcpu->c_quantum_start = curcpu->c_hardclocks;
 		spinlock_release(&curcpu->c_runqueue_lock);
+		rcu_quiescent();
 		splx(spl);
 		return;
 	}
 
+	/* Remember where and when it last ran, for migration. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastrun = curcpu->c_hardclocks;
+
+	/* Count the switch; a dying thread's last one doesn't count. */
+	if (cur->t_preempting) {
+		cur->t_usage.u_nivcsw++;
+	}
+	else if (newstate != S_ZOMBIE) {
+		cur->t_usage.u_nvcsw++;
+	}
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -632,10 +888,20 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = thread_pick_next(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/*
+			 * Before actually idling, try to steal work from
+			 * the busiest other cpu (see thread_steal) rather
+			 * than waiting for it to push some to us in
+			 * thread_consider_migration. This has to be done
+			 * with our own run queue unlocked; thread_steal
+			 * takes both locks itself in a fixed order.
+			 */
+			if (!thread_steal()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -651,6 +917,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+	/* Start the new thread's quantum. */
+	curcpu->c_switches++;
+	curcpu->c_quantum_start = curcpu->c_hardclocks;
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -714,6 +984,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* A context switch is an RCU quiescent state. */
+	rcu_quiescent();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -747,6 +1020,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* A context switch is an RCU quiescent state. */
+	rcu_quiescent();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -817,6 +1093,14 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+void
+thread_preempt(void)
+{
+	curthread->t_preempting = true;
+	thread_switch(S_READY, NULL);
+	curthread->t_preempting = false;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -824,15 +1108,141 @@ thread_yield(void)
  *
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * With only round-robin threads there is nothing to do. With stride
+ * scheduling, the actual choice of the lowest-pass thread is made in
+ * thread_pick_next() at switch time; here we just keep the cpu's
+ * virtual time (c_pass) caught up with the least-advanced runnable
+ * thread, so threads waking up or migrating in are placed fairly
+ * relative to the ones already competing.
  */
-
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	uint64_t minpass;
+
+	if (sched_nstride == 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	minpass = curthread->t_pass;
+	if (!threadlist_isempty(&curcpu->c_runqueue)) {
+		THREADLIST_FORALL(t, curcpu->c_runqueue) {
+			if (t->t_pass < minpass) {
+				minpass = t->t_pass;
+			}
+		}
+	}
+	if (minpass > curcpu->c_pass) {
+		curcpu->c_pass = minpass;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Charge the current thread for one hardclock.
+ */
+void
+thread_account_tick(bool user)
+{
+	struct thread *cur = curthread;
+	unsigned win;
+
+	cur->t_pass += cur->t_stride;
+	if (user) {
+		cur->t_usage.u_uticks++;
+	}
+	else {
+		cur->t_usage.u_sticks++;
+	}
+
+	win = clock_uptime();
+	if (cur->t_cpuwin != win) {
+		cur->t_cpuprev = (cur->t_cpuwin + 1 == win) ? cur->t_cpunow : 0;
+		cur->t_cpunow = 0;
+		cur->t_cpuwin = win;
+	}
+	cur->t_cpunow++;
+}
+
+unsigned
+thread_recentcpu(struct thread *t)
+{
+	unsigned win, twin;
+
+	win = clock_uptime();
+	twin = t->t_cpuwin;
+	if (twin == win) {
+		return t->t_cpuprev;
+	}
+	if (twin + 1 == win) {
+		return t->t_cpunow;
+	}
+	return 0;
+}
+
+void
+usage_add(struct usage *to, const struct usage *from)
+{
+	to->u_uticks += from->u_uticks;
+	to->u_sticks += from->u_sticks;
+	to->u_minflt += from->u_minflt;
+	to->u_nvcsw += from->u_nvcsw;
+	to->u_nivcsw += from->u_nivcsw;
+}
+
+/*
+ * Change a thread's scheduling class and share. The new stride takes
+ * effect from the thread's next hardclock.
+ */
+int
+thread_setshare(struct thread *t, int schedclass, unsigned tickets)
+{
+	if (schedclass == SCHED_RR) {
+		tickets = STRIDE_DEFAULT_TICKETS;
+	}
+	else if (schedclass != SCHED_STRIDE) {
+		return EINVAL;
+	}
+	if (tickets < 1 || tickets > STRIDE_MAX_TICKETS) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&sched_lock);
+	if (t->t_schedclass != schedclass) {
+		if (schedclass == SCHED_STRIDE) {
+			sched_nstride++;
+		}
+		else {
+			KASSERT(sched_nstride > 0);
+			sched_nstride--;
+		}
+		t->t_schedclass = schedclass;
+	}
+	t->t_tickets = tickets;
+	t->t_stride = STRIDE1 / (tickets > t->t_inherit ?
+				 tickets : t->t_inherit);
+	spinlock_release(&sched_lock);
+
+	return 0;
+}
+
+/*
+ * Record a share inherited through a lock. Like thread_setshare, the
+ * new stride takes effect from the next hardclock.
+ */
+void
+thread_inherit(struct thread *t, unsigned tickets)
+{
+	KASSERT(tickets <= STRIDE_MAX_TICKETS);
+
+	spinlock_acquire(&sched_lock);
+	t->t_inherit = tickets;
+	t->t_stride = STRIDE1 / (t->t_tickets > tickets ?
+				 t->t_tickets : tickets);
+	spinlock_release(&sched_lock);
 }
 
 /*
@@ -848,15 +1258,86 @@ schedule(void)
  * and the performance loss due to underutilization of some CPUs is
  * something that needs to be tuned and probably is workload-specific.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * So we only push threads away when this CPU is more than
+ * migrate_hysteresis threads over its fair share, so that a mild or
+ * momentary imbalance doesn't bounce threads back and forth; and
+ * when we do, we prefer threads that haven't run for at least
+ * migrate_coldticks hardclocks, whose cache state is likely gone
+ * anyway. Cache-warm threads are only sent if there aren't enough
+ * cold ones. Both knobs can be changed with thread_migration_tune().
  */
+
+#define MIGRATE_COLDTICKS	8	/* Default cold threshold */
+#define MIGRATE_HYSTERESIS	1	/* Default slack over fair share */
+
+static unsigned migrate_coldticks = MIGRATE_COLDTICKS;
+static unsigned migrate_hysteresis = MIGRATE_HYSTERESIS;
+
+/*
+ * Check if a thread has been off-cpu long enough that migrating it
+ * should cost nothing extra in cache misses. The hardclock counter of
+ * another cpu is read unlocked; it's only a heuristic.
+ */
+static
+bool
+thread_is_cold(struct thread *t)
+{
+	if (t->t_lastcpu == NULL) {
+		/* Never ran, so it has no cache state anywhere. */
+		return true;
+	}
+	return t->t_lastcpu->c_hardclocks - t->t_lastrun >= migrate_coldticks;
+}
+
+/*
+ * Pick a thread to move off C's run queue, which must be locked,
+ * preferring cache-cold threads and starting from the tail. Never
+ * picks C's curthread (see below) or a pinned thread. If WARM is
+ * false only cold threads are considered. The thread is removed from
+ * the run queue and returned, or NULL if nothing suitable is there.
+ *
+ * Ordinarily, curthread will not appear on the run queue. However,
+ * it can under the following circumstances:
+ *   - it went to sleep;
+ *   - the processor became idle, so it remained curthread;
+ *   - it was reawakened, so it was put on the run queue;
+ *   - and the processor hasn't fully unidled yet, so all these
+ *     things are still true.
+ *
+ * If the timer interrupt happens at (almost) exactly the proper
+ * moment, we can come here while things are in this state and see
+ * curthread. However, *migrating* curthread can cause bad things to
+ * happen (Exercise: Why? And what?) so it is skipped.
+ */
+static
+struct thread *
+thread_pick_migrant(struct cpu *c, bool warm)
+{
+	struct threadlistnode *node;
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (node = c->c_runqueue.tl_tail.tln_prev;
+	     node->tln_prev != NULL;
+	     node = node->tln_prev) {
+		t = node->tln_self;
+		if (t == c->c_curthread || t->t_pinned) {
+			continue;
+		}
+		if (warm || thread_is_cold(t)) {
+			threadlist_remove(&c->c_runqueue, t);
+			return t;
+		}
+	}
+	return NULL;
+}
+
 void
 thread_consider_migration(void)
 {
 	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
+	unsigned i, numcpus, nwarm, npicked, nsent;
 	struct cpu *c;
 	struct threadlist victims;
 	struct thread *t;
@@ -874,17 +1355,30 @@ thread_consider_migration(void)
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	if (my_count <= one_share + migrate_hysteresis) {
 		return;
 	}
 
+	/*
+	 * Cold threads are picked first, so any warm ones are at the
+	 * tail of the victim list and are the last to be sent.
+	 */
 	to_send = my_count - one_share;
+	nwarm = 0;
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+		t = thread_pick_migrant(curcpu->c_self, false);
+		if (t == NULL) {
+			t = thread_pick_migrant(curcpu->c_self, true);
+			if (t == NULL) {
+				break;
+			}
+			nwarm++;
+		}
+		threadlist_addtail(&victims, t);
 	}
+	to_send = npicked = victims.tl_count;
 	spinlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
@@ -895,36 +1389,10 @@ thread_consider_migration(void)
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
 			t->t_cpu = c;
+			thread_stride_join(c, t);
 			threadlist_addtail(&c->c_runqueue, t);
+			c->c_migrate_in++;
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -945,18 +1413,160 @@ thread_consider_migration(void)
 	 * changed while we were working and we may end up with leftovers.
 	 * Don't panic; just put them back on our own run queue.
 	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	nsent = npicked - to_send;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curcpu->c_migrate_out += nsent;
+	if (nsent > npicked - nwarm) {
+		curcpu->c_migrate_warm += nsent - (npicked - nwarm);
+	}
+	while ((t = threadlist_remhead(&victims)) != NULL) {
+		threadlist_addtail(&curcpu->c_runqueue, t);
 	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 
 	KASSERT(threadlist_isempty(&victims));
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Adjust the migration policy.
+ */
+void
+thread_migration_tune(unsigned coldticks, unsigned hysteresis)
+{
+	migrate_coldticks = coldticks;
+	migrate_hysteresis = hysteresis;
+}
+
+/*
+ * Print (and optionally clear) the migration and context switch
+ * counters.
+ */
+void
+thread_migration_stats(bool reset)
+{
+	unsigned i, numcpus;
+	unsigned out, warm, in, steals;
+	struct cpu *c;
+
+	kprintf("Migration policy: cold after %u hardclocks, "
+		"hysteresis %u\n", migrate_coldticks, migrate_hysteresis);
+	kprintf("cpu       out      warm        in    stolen  switches\n");
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		out = c->c_migrate_out;
+		warm = c->c_migrate_warm;
+		in = c->c_migrate_in;
+		steals = c->c_steals;
+		if (reset) {
+			c->c_migrate_out = 0;
+			c->c_migrate_warm = 0;
+			c->c_migrate_in = 0;
+			c->c_steals = 0;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+
+		/*
+		 * Don't kprintf with a spinlock held. c_switches
+		 * belongs to the other cpu, so this is only a
+		 * snapshot.
+		 */
+		kprintf("%3u %9u %9u %9u %9u %9u\n",
+			c->c_number, out, warm, in, steals, c->c_switches);
+		if (reset) {
+			c->c_switches = 0;
+		}
+	}
+}
+
+/*
+ * Work stealing.
+ *
+ * This is called from thread_switch when the current CPU has run out
+ * of things to do and is about to go idle. Rather than sitting in
+ * cpu_idle() until thread_consider_migration on some busy CPU gets
+ * around to pushing work at us, pull a thread off the tail of the
+ * busiest other run queue. Returns true if a thread was moved onto
+ * our run queue.
+ *
+ * Must be called with interrupts off and *without* our own run queue
+ * lock held. To avoid deadlocking against another CPU stealing from
+ * us at the same moment, the two run queue locks are always taken in
+ * order of increasing cpu number. The counts used to pick the victim
+ * are read unlocked; they are only a hint and are rechecked once the
+ * locks are held.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *me, *victim, *c, *first, *second;
+	struct thread *t;
+	unsigned i, numcpus, count, maxcount;
+
+	me = curcpu->c_self;
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus == 1) {
+		return false;
+	}
+
+	victim = NULL;
+	maxcount = 0;
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == me) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > maxcount) {
+			maxcount = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	if (me->c_number < victim->c_number) {
+		first = me;
+		second = victim;
+	}
+	else {
+		first = victim;
+		second = me;
+	}
+	spinlock_acquire(&first->c_runqueue_lock);
+	spinlock_acquire(&second->c_runqueue_lock);
+
+	/*
+	 * Take from the tail, since those threads have been waiting
+	 * least and are least likely to run there soon anyway, and
+	 * prefer cache-cold ones. Unlike thread_consider_migration we
+	 * will take a warm thread if that's all there is; running it
+	 * with a cold cache beats not running it at all.
+	 */
+	t = thread_pick_migrant(victim, false);
+	if (t == NULL) {
+		t = thread_pick_migrant(victim, true);
+	}
+	if (t != NULL) {
+		t->t_cpu = me;
+		thread_stride_join(me, t);
+		threadlist_addtail(&me->c_runqueue, t);
+		me->c_steals++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, me->c_number);
+	}
+
+	spinlock_release(&second->c_runqueue_lock);
+	spinlock_release(&first->c_runqueue_lock);
+
+	return t != NULL;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -981,6 +1591,7 @@ wchan_create(const char *name)
 		return NULL;
 	}
 	spinlock_init(&wc->wc_lock);
+	spinlock_setname(&wc->wc_lock, name);
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 	return wc;
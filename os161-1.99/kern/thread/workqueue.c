@@ -0,0 +1,308 @@
+/*
+ * Per-cpu work queues. See workqueue.h.
+ *
+ * The pending bit is a spinlock_data_t so that claiming a work item
+ * is a single test-and-set, whichever cpu's queue it is headed for;
+ * the queue locks only cover the lists.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <clock.h>
+#include <workqueue.h>
+
+static
+uint64_t
+workqueue_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+void
+work_init(struct work *wk, void (*func)(void *), void *data)
+{
+	wk->wk_func = func;
+	wk->wk_data = data;
+	spinlock_data_set(&wk->wk_pending, 0);
+	wk->wk_cpu = 0;
+	wk->wk_queued = 0;
+	timeout_init(&wk->wk_timeout, NULL, NULL);
+	wk->wk_next = NULL;
+}
+
+void
+workqueue_init(struct workqueue *wq)
+{
+	spinlock_init(&wq->wq_lock);
+	spinlock_setname(&wq->wq_lock, "workqueue");
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_wchan = wchan_create("workqueue");
+	if (wq->wq_wchan == NULL) {
+		panic("workqueue_init: Out of memory\n");
+	}
+	wq->wq_depth = 0;
+	wq->wq_maxdepth = 0;
+	wq->wq_queued = 0;
+	wq->wq_run = 0;
+	wq->wq_latsum = 0;
+	wq->wq_latmax = 0;
+}
+
+/*
+ * Put an item the caller has already claimed on wk_cpu's queue.
+ */
+static
+void
+workqueue_enqueue(struct work *wk)
+{
+	struct workqueue *wq;
+
+	wq = &cpu_get(wk->wk_cpu)->c_workqueue;
+	wk->wk_queued = workqueue_now();
+	wk->wk_next = NULL;
+
+	spinlock_acquire(&wq->wq_lock);
+	*wq->wq_tailp = wk;
+	wq->wq_tailp = &wk->wk_next;
+	wq->wq_depth++;
+	if (wq->wq_depth > wq->wq_maxdepth) {
+		wq->wq_maxdepth = wq->wq_depth;
+	}
+	wq->wq_queued++;
+	spinlock_release(&wq->wq_lock);
+
+	/*
+	 * An idle worker locked the channel before dropping wq_lock,
+	 * so it is either asleep already or will see the item.
+	 */
+	wchan_wakeone(wq->wq_wchan);
+}
+
+bool
+workqueue_add_on(unsigned cpunum, struct work *wk)
+{
+	KASSERT(cpunum < cpu_count());
+
+	if (spinlock_data_testandset(&wk->wk_pending) != 0) {
+		return false;
+	}
+	wk->wk_cpu = cpunum;
+	workqueue_enqueue(wk);
+	return true;
+}
+
+bool
+workqueue_add(struct work *wk)
+{
+	return workqueue_add_on(curcpu->c_number, wk);
+}
+
+/*
+ * Timeout handler for delayed work.
+ */
+static
+void
+workqueue_timeout(void *data)
+{
+	workqueue_enqueue(data);
+}
+
+bool
+workqueue_add_delayed(struct work *wk, uint64_t nticks)
+{
+	if (nticks == 0) {
+		return workqueue_add(wk);
+	}
+	if (spinlock_data_testandset(&wk->wk_pending) != 0) {
+		return false;
+	}
+	wk->wk_cpu = curcpu->c_number;
+	timeout_init(&wk->wk_timeout, workqueue_timeout, wk);
+	timeout_add(&wk->wk_timeout, nticks);
+	return true;
+}
+
+bool
+workqueue_cancel(struct work *wk)
+{
+	struct workqueue *wq;
+	struct work **wkp;
+	bool found;
+
+	if (spinlock_data_get(&wk->wk_pending) == 0) {
+		return false;
+	}
+
+	if (timeout_del(&wk->wk_timeout)) {
+		spinlock_data_set(&wk->wk_pending, 0);
+		return true;
+	}
+
+	found = false;
+	wq = &cpu_get(wk->wk_cpu)->c_workqueue;
+	spinlock_acquire(&wq->wq_lock);
+	for (wkp = &wq->wq_head; *wkp != NULL; wkp = &(*wkp)->wk_next) {
+		if (*wkp == wk) {
+			*wkp = wk->wk_next;
+			if (wq->wq_tailp == &wk->wk_next) {
+				wq->wq_tailp = wkp;
+			}
+			wq->wq_depth--;
+			spinlock_data_set(&wk->wk_pending, 0);
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+	return found;
+}
+
+/*
+ * Worker thread: one per cpu, never migrated, never exits.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *wk;
+	void (*func)(void *);
+	void *data;
+	uint64_t lat;
+
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		wk = wq->wq_head;
+		wq->wq_head = wk->wk_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tailp = &wq->wq_head;
+		}
+		wq->wq_depth--;
+		lat = workqueue_now() - wk->wk_queued;
+		wq->wq_latsum += lat;
+		if (lat > wq->wq_latmax) {
+			wq->wq_latmax = lat;
+		}
+		wq->wq_run++;
+		spinlock_release(&wq->wq_lock);
+
+		/* once it's not pending, WK may be requeued or freed */
+		func = wk->wk_func;
+		data = wk->wk_data;
+		spinlock_data_set(&wk->wk_pending, 0);
+		func(data);
+	}
+}
+
+/*
+ * Flushing: queue a marker on every cpu and wait for them all. Each
+ * queue is FIFO, so everything ahead of the marker has run.
+ */
+static
+void
+workqueue_flushone(void *data)
+{
+	V((struct semaphore *)data);
+}
+
+void
+workqueue_flush(void)
+{
+	struct semaphore *sem;
+	struct work *marks;
+	unsigned i, n;
+
+	n = cpu_count();
+	sem = sem_create("wqflush", 0);
+	marks = kmalloc(n * sizeof(*marks));
+	if (sem == NULL || marks == NULL) {
+		panic("workqueue_flush: Out of memory\n");
+	}
+	for (i=0; i<n; i++) {
+		work_init(&marks[i], workqueue_flushone, sem);
+		workqueue_add_on(i, &marks[i]);
+	}
+	for (i=0; i<n; i++) {
+		P(sem);
+	}
+	kfree(marks);
+	sem_destroy(sem);
+}
+
+void
+workqueue_stats(bool reset)
+{
+	struct workqueue *wq;
+	unsigned i, n;
+	unsigned depth, maxdepth, queued, run;
+	uint64_t latsum, latmax;
+
+	kprintf("cpu   depth    max     queued        run"
+		"  avg lat us  max lat us\n");
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		wq = &cpu_get(i)->c_workqueue;
+		spinlock_acquire(&wq->wq_lock);
+		depth = wq->wq_depth;
+		maxdepth = wq->wq_maxdepth;
+		queued = wq->wq_queued;
+		run = wq->wq_run;
+		latsum = wq->wq_latsum;
+		latmax = wq->wq_latmax;
+		if (reset) {
+			wq->wq_maxdepth = depth;
+			wq->wq_queued = 0;
+			wq->wq_run = 0;
+			wq->wq_latsum = 0;
+			wq->wq_latmax = 0;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		kprintf("%3u %7u %6u %10u %10u %11lu %11lu\n",
+			i, depth, maxdepth, queued, run,
+			(unsigned long)(run ? latsum / run / 1000 : 0),
+			(unsigned long)(latmax / 1000));
+	}
+	if (reset) {
+		kprintf("workqueue: statistics reset\n");
+	}
+}
+
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	unsigned i, n;
+	int result;
+
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		wq = &cpu_get(i)->c_workqueue;
+		result = thread_fork_pinned("workqueue", NULL, i,
+					    workqueue_worker, wq, i);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork_pinned: %s\n",
+			      strerror(result));
+		}
+	}
+}
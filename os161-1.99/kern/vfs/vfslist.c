@@ -43,6 +43,9 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <clock.h>
+#include <workqueue.h>
+#include <addrspace.h>
 
 /*
  * Structure for a single named device.
@@ -169,6 +172,32 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * Background write-back: sync everything every VFS_SYNC_SECONDS,
+ * so a crash loses at most that much. Runs from the work queue, and
+ * rearms itself each time.
+ */
+#define VFS_SYNC_SECONDS 30
+
+static struct work vfs_syncwork;
+
+static
+void
+vfs_syncer(void *junk)
+{
+	(void)junk;
+
+	vfs_sync();
+	workqueue_add_delayed(&vfs_syncwork, clock_ticks(VFS_SYNC_SECONDS, 0));
+}
+
+void
+vfs_syncer_start(void)
+{
+	work_init(&vfs_syncwork, vfs_syncer, NULL);
+	workqueue_add_delayed(&vfs_syncwork, clock_ticks(VFS_SYNC_SECONDS, 0));
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -571,6 +600,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* cached executables would otherwise keep it busy */
+	elfcache_purge(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -619,6 +651,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		elfcache_purge(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
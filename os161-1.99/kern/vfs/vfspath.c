@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <addrspace.h>
 
 
 /* Does most of the work for open(). */
@@ -140,7 +141,7 @@ vfs_close(struct vnode *vn)
 int
 vfs_remove(char *path)
 {
-	struct vnode *dir;
+	struct vnode *dir, *file;
 	char name[NAME_MAX+1];
 	int result;
 	
@@ -149,6 +150,12 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	/* a cached executable image would keep the file from being freed */
+	if (VOP_LOOKUP(dir, name, &file) == 0) {
+		elfcache_forget(file);
+		VOP_DECREF(file);
+	}
+
 	result = VOP_REMOVE(dir, name);
 	VOP_DECREF(dir);
 
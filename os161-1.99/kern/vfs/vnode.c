@@ -36,6 +36,7 @@
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <spinlock.h>
 
 /*
  * Initialize an abstract vnode.
@@ -51,6 +52,8 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	vn->vn_opencount = 0;
+	spinlock_init(&vn->vn_versionlock);
+	vn->vn_version = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -66,6 +69,7 @@ vnode_cleanup(struct vnode *vn)
 	KASSERT(vn->vn_refcount==1);
 	KASSERT(vn->vn_opencount==0);
 
+	spinlock_cleanup(&vn->vn_versionlock);
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
 	vn->vn_opencount = 0;
@@ -74,6 +78,45 @@ vnode_cleanup(struct vnode *vn)
 }
 
 
+static
+void
+vnode_bumpversion(struct vnode *vn)
+{
+	/* per vnode, so writers to different files don't contend */
+	spinlock_acquire(&vn->vn_versionlock);
+	vn->vn_version++;
+	spinlock_release(&vn->vn_versionlock);
+}
+
+/*
+ * Write, and note that the contents changed.
+ * Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	/* even a failed write may have changed something */
+	vnode_bumpversion(vn);
+	return result;
+}
+
+/*
+ * Truncate, and note that the contents changed.
+ * Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, pos);
+	vnode_bumpversion(vn);
+	return result;
+}
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
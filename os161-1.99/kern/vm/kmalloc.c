@@ -195,7 +195,8 @@ static struct pageref *allbase;
  * OS/161 performance and scalability aren't super-critical.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock =
+	SPINLOCK_FAIR_INITIALIZER("kmalloc");
 
 ////////////////////////////////////////
 
@@ -347,6 +348,28 @@ kheap_printstats(void)
 	spinlock_release(&kmalloc_spinlock);
 }
 
+/*
+ * Bytes handed out by the subpage allocator, and the pages it holds.
+ * Blocks bigger than the largest subpage size come straight from
+ * alloc_kpages and aren't counted.
+ */
+void
+kheap_getusage(size_t *used, unsigned *npages)
+{
+	struct pageref *pr;
+	size_t size;
+
+	*used = 0;
+	*npages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		size = sizes[PR_BLOCKTYPE(pr)];
+		*used += (PAGE_SIZE / size - pr->nfree) * size;
+		(*npages)++;
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
 ////////////////////////////////////////
 
 static
@@ -311,6 +311,7 @@ docommand(char *buf)
 	int bg=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
+	struct rusage ru;
 
 	nargs = 0;
 	for (s = strtok(buf, " \t\r\n"); s; s = strtok(NULL, " \t\r\n")) {
@@ -354,29 +355,12 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
-	}
-
-	/* parent */
+	pid = spawn(args[0], args, NULL, 0);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
+	}
+
 	if (bg) {
 		/* background this command */
 		remember_bg(pid);
@@ -384,8 +368,8 @@ docommand(char *buf)
 		return 0;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		warn("wait4");
 		status = -1;
 	}
 
@@ -399,6 +383,11 @@ docommand(char *buf)
 		endsecs -= startsecs;
 		warnx("subprocess time: %lu.%09lu seconds",
 		      (unsigned long) endsecs, (unsigned long) endnsecs);
+		warnx("user %lu.%06lu sys %lu.%06lu",
+		      (unsigned long) ru.ru_utime.tv_sec,
+		      (unsigned long) ru.ru_utime.tv_usec,
+		      (unsigned long) ru.ru_stime.tv_sec,
+		      (unsigned long) ru.ru_stime.tv_usec);
 	}
 
 	return status;
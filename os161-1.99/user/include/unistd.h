@@ -42,6 +42,8 @@
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* needs struct timeval */
+#include <kern/procstat.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -153,15 +155,68 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
+int getrusage(int who, struct rusage *usage);
+pid_t wait4(pid_t pid, int *returncode, int flags, struct rusage *usage);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
+/*
+ * Local additions.
+ *
+ * setshare gives process PID (0 for the caller) TICKETS shares of the
+ * cpu under proportional-share scheduling, or returns it to ordinary
+ * round-robin scheduling if TICKETS is 0. Children inherit it.
+ *
+ * futex_wait sleeps on ADDR if *ADDR still equals VAL (otherwise it
+ * fails with EAGAIN); futex_wake wakes up to N threads sleeping on
+ * ADDR in the same address space and returns how many it woke. ADDR
+ * must be int-aligned.
+ *
+ * vfork is fork without copying the address space: the child runs in
+ * the parent's memory and the parent is suspended until the child
+ * calls execv or _exit. The child must do nothing else; in particular
+ * it must not return from the function that called vfork.
+ *
+ * spawn starts a child running PROG with argument vector ARGS and
+ * returns its pid, much like fork followed by execv in the child, but
+ * without copying the parent. The child's descriptor i shares the
+ * open file of the parent's FDS[i], or is closed if that is -1; with
+ * NFDS 0 (and FDS NULL) it shares the parent's descriptors 0, 1 and 2.
+ *
+ * thread_exit ends the calling thread, handing RETVAL to whoever
+ * joins it; thread_join waits for thread TID of this process to end
+ * and collects that value. A thread's id can't be reused until it
+ * has been joined. When the last thread exits the process exits with
+ * status 0; _exit, or a fatal signal in any thread, ends them all.
+ * execv fails with EBUSY while there is more than one thread. Not
+ * much of libc may be used by two threads at once: in particular
+ * malloc and errno are shared.
+ *
+ * procstat fills BUF with up to N process listings, in pid order, and
+ * returns how many it filled in; if SS isn't NULL it also fills in
+ * system-wide figures, including the total number of processes. The
+ * listing is gathered a few processes at a time, so it isn't a
+ * single snapshot.
+ */
+int setshare(pid_t pid, int tickets);
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args, const int *fds, int nfds);
+int __thread_create(void (*entry)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
+__DEAD void thread_exit(void *retval);
+int thread_join(int tid, void **retval);
+int procstat(struct procinfo *buf, int n, struct sysstat *ss);
+
 /*
  * These are not themselves system calls, but wrapper routines in libc.
  */
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int thread_create(void *(*func)(void *), void *arg); /* __thread_create */
 
 #endif /* _UNISTD_H_ */
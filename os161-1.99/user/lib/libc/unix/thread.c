@@ -0,0 +1,25 @@
+/*
+ * Threads. See unistd.h.
+ */
+
+#include <unistd.h>
+
+/*
+ * Where the kernel starts a new thread: run its function, and exit
+ * with the result if it returns.
+ */
+static
+void
+__thread_start(void *(*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+/*
+ * Start FUNC(ARG) in a new thread and return its id.
+ */
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	return __thread_create(__thread_start, func, arg);
+}
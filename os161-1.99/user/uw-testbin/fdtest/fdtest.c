@@ -0,0 +1,119 @@
+/*
+ * fdtest - check open, read, write, lseek, close and dup2
+ *
+ *  relies on fork, waitpid, the file system calls, and console write
+ *
+ *  writes a file partly from a forked child to check that the two
+ *  share the offset, reads it back through a descriptor and its dup2
+ *  copy, which share one too, and checks the error cases. leaves
+ *  fdtest.tmp behind in the current directory, as there is no
+ *  remove. failures are reported as they happen, then a summary is
+ *  printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+#define TESTFILE "fdtest.tmp"
+#define DUPFD    10
+
+int
+main(int argc, char *argv[])
+{
+  char buf[16];
+  pid_t pid;
+  int fd, status, r;
+  off_t pos;
+
+  (void)argc;
+  (void)argv;
+
+  fd = open("/nonexistent/file", O_RDONLY);
+  TEST_NEGATIVE(fd, "open missing file");
+  TEST_EQUAL(errno, ENOENT, "open missing file");
+  fd = open(TESTFILE, 3);
+  TEST_NEGATIVE(fd, "open with bad flags");
+  TEST_EQUAL(errno, EINVAL, "open with bad flags");
+
+  fd = open(TESTFILE, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+  if (fd < 0) {
+    err(1, "%s", TESTFILE);
+  }
+  TEST_EQUAL(fd, 3, "lowest free descriptor");
+  TEST_EQUAL(write(fd, "abc", 3), 3, "write");
+
+  /* the child's write must land after ours, and ours after its */
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    _exit(write(fd, "def", 3) == 3 ? 0 : 1);
+  }
+  r = waitpid(pid, &status, 0);
+  TEST_EQUAL(r, pid, "waitpid");
+  TEST_EQUAL(WIFEXITED(status) && WEXITSTATUS(status) == 0, 1,
+             "child wrote");
+  TEST_EQUAL(write(fd, "ghi", 3), 3, "write after child");
+
+  pos = lseek(fd, 0, SEEK_CUR);
+  TEST_EQUAL((int)pos, 9, "offset shared with child");
+  pos = lseek(fd, 0, SEEK_END);
+  TEST_EQUAL((int)pos, 9, "seek to end");
+  r = read(fd, buf, sizeof(buf));
+  TEST_NEGATIVE(r, "read on write-only");
+  TEST_EQUAL(errno, EBADF, "read on write-only");
+
+  TEST_EQUAL(close(fd), SUCCESS, "close");
+  r = close(fd);
+  TEST_NEGATIVE(r, "close twice");
+  TEST_EQUAL(errno, EBADF, "close twice");
+  r = write(fd, "x", 1);
+  TEST_NEGATIVE(r, "write after close");
+  TEST_EQUAL(errno, EBADF, "write after close");
+
+  fd = open(TESTFILE, O_RDONLY);
+  if (fd < 0) {
+    err(1, "%s", TESTFILE);
+  }
+  r = read(fd, buf, sizeof(buf));
+  TEST_EQUAL(r, 9, "read back");
+  TEST_EQUAL(memcmp(buf, "abcdefghi", 9), 0, "read back");
+  r = read(fd, buf, sizeof(buf));
+  TEST_EQUAL(r, 0, "read at end");
+
+  TEST_EQUAL(dup2(fd, DUPFD), DUPFD, "dup2");
+  TEST_EQUAL((int)lseek(DUPFD, 3, SEEK_SET), 3, "seek duplicate");
+  r = read(fd, buf, 3);
+  TEST_EQUAL(r, 3, "offset shared with duplicate");
+  TEST_EQUAL(memcmp(buf, "def", 3), 0, "offset shared with duplicate");
+  TEST_EQUAL(dup2(fd, fd), fd, "dup2 onto itself");
+  r = dup2(fd, -1);
+  TEST_NEGATIVE(r, "dup2 bad target");
+  TEST_EQUAL(errno, EBADF, "dup2 bad target");
+
+  pos = lseek(fd, -1, SEEK_SET);
+  TEST_NEGATIVE((int)pos, "seek before start");
+  TEST_EQUAL(errno, EINVAL, "seek before start");
+  pos = lseek(fd, 0, 42);
+  TEST_NEGATIVE((int)pos, "seek bad whence");
+  TEST_EQUAL(errno, EINVAL, "seek bad whence");
+  pos = lseek(STDOUT_FILENO, 0, SEEK_SET);
+  TEST_NEGATIVE((int)pos, "seek on console");
+  TEST_EQUAL(errno, ESPIPE, "seek on console");
+
+  TEST_EQUAL(close(DUPFD), SUCCESS, "close duplicate");
+  r = read(fd, buf, 3);
+  TEST_EQUAL(r, 3, "original still open");
+  TEST_EQUAL(memcmp(buf, "ghi", 3), 0, "original still open");
+  close(fd);
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
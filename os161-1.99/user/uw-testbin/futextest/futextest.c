@@ -0,0 +1,48 @@
+/*
+ * futextest - check the futex_wait/futex_wake argument handling
+ *
+ *  relies on futex_wait, futex_wake, and console write
+ *
+ *  checks the cases that must return at once: a stale value, a wake
+ *  with nobody waiting, and bad addresses. threadtest checks that a
+ *  wait actually sleeps. failures are reported as they happen, then a
+ *  summary is printed.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include "../lib/testutils.h"
+
+static volatile int word = 17;
+static volatile int pair[2];
+
+int
+main(int argc, char *argv[])
+{
+  int r;
+
+  (void)argc;
+  (void)argv;
+
+  r = futex_wait(&word, 18);
+  TEST_NEGATIVE(r, "wait on a stale value");
+  TEST_EQUAL(errno, EAGAIN, "wait on a stale value");
+  TEST_EQUAL(futex_wake(&word, 1), 0, "wake with no waiters");
+  TEST_EQUAL(futex_wake(&word, 0), 0, "wake zero");
+  r = futex_wake(&word, -1);
+  TEST_NEGATIVE(r, "wake negative");
+  TEST_EQUAL(errno, EINVAL, "wake negative");
+  r = futex_wait((volatile int *)((volatile char *)pair + 1), 0);
+  TEST_NEGATIVE(r, "misaligned address");
+  TEST_EQUAL(errno, EINVAL, "misaligned address");
+  r = futex_wait((volatile int *)0x80000000, 0);
+  TEST_NEGATIVE(r, "kernel address");
+  TEST_EQUAL(errno, EFAULT, "kernel address");
+  r = futex_wait(NULL, 0);
+  TEST_NEGATIVE(r, "null address");
+  TEST_EQUAL(errno, EFAULT, "null address");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
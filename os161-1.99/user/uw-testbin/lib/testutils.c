@@ -166,6 +166,13 @@ test_not_equal(int val1, int val2, const char *str,
   }
 }
 
+/* Number of failures so far, e.g. for an exit status */
+int
+test_failures(void)
+{
+  return num_failures;
+}
+
 /* Reset the statistic counters */
 void
 test_reset_stats(void)
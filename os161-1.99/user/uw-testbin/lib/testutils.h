@@ -39,6 +39,7 @@ void test_not_equal(int ret_val, int expected_val, const char *str,
      const char *file, const char* func, int line);
 void test_print_stats(const char *file, const char* func, int line);
 void test_reset_stats(void);
+int test_failures(void);
 void test_verbose_on(void);
 void test_verbose_off(void);
 
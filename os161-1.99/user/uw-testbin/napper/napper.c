@@ -0,0 +1,68 @@
+/*
+ * napper - check that nanosleep() sleeps for at least as long as asked
+ *
+ *  relies on nanosleep, __time, and console write
+ *
+ *  sleeps for a range of intervals, timing each one with __time(), and
+ *  prints a line per interval.  each should report "ok"; an interval
+ *  that returned early prints "EARLY" instead.  sleeping a little
+ *  longer than asked is expected, since the kernel rounds up to
+ *  whole timer ticks.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define NSEC_PER_SEC 1000000000L
+
+static const long intervals[] = {
+  1000000L,        /* 1 ms   */
+  10000000L,       /* 10 ms  */
+  50000000L,       /* 50 ms  */
+  250000000L,      /* 250 ms */
+  1200000000L,     /* 1.2 s  */
+};
+#define NINTERVALS (sizeof(intervals) / sizeof(intervals[0]))
+
+int
+main(int argc, char *argv[])
+{
+  struct timespec req, rem;
+  time_t s1, s2;
+  unsigned long ns1, ns2;
+  long elapsed;
+  unsigned i;
+  int failed = 0;
+
+  (void)argc;
+  (void)argv;
+
+  for (i = 0; i < NINTERVALS; i++) {
+    req.tv_sec = intervals[i] / NSEC_PER_SEC;
+    req.tv_nsec = intervals[i] % NSEC_PER_SEC;
+
+    __time(&s1, &ns1);
+    if (nanosleep(&req, &rem) < 0) {
+      err(1, "nanosleep");
+    }
+    __time(&s2, &ns2);
+
+    elapsed = (long)(s2 - s1) * NSEC_PER_SEC + (long)ns2 - (long)ns1;
+    printf("asked %ld us, slept %ld us: %s\n",
+           intervals[i] / 1000, elapsed / 1000,
+           elapsed >= intervals[i] ? "ok" : "EARLY");
+    if (elapsed < intervals[i]) {
+      failed = 1;
+    }
+  }
+
+  req.tv_sec = 0;
+  req.tv_nsec = NSEC_PER_SEC;
+  if (nanosleep(&req, NULL) == 0) {
+    printf("nanosleep with tv_nsec out of range succeeded\n");
+    failed = 1;
+  }
+
+  printf("napper %s\n", failed ? "FAILED" : "done");
+  return failed;
+}
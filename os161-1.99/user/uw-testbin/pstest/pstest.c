@@ -0,0 +1,119 @@
+/*
+ * pstest - check procstat
+ *
+ *  relies on fork, _exit, waitpid, getpid, procstat, and console write
+ *
+ *  forks a child that exits straight away and, before reaping it,
+ *  checks that the listing shows this process running with one
+ *  thread and some memory, and the child as a zombie whose parent is
+ *  this process. then checks the system figures and the error cases.
+ *  prints the listing it got; failures are reported as they happen,
+ *  then a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+#define MAXPROCS 32
+
+static struct procinfo procs[MAXPROCS];
+
+static
+struct procinfo *
+find(int n, pid_t pid)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (procs[i].pi_pid == pid) {
+      return &procs[i];
+    }
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysstat ss;
+  struct procinfo *me, *kid;
+  pid_t pid, self;
+  int n, i, status, r;
+
+  (void)argc;
+  (void)argv;
+
+  self = getpid();
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    _exit(0);
+  }
+
+  /* give the child time to exit */
+  for (i = 0; i < 100; i++) {
+    n = procstat(procs, MAXPROCS, &ss);
+    if (n < 0) {
+      err(1, "procstat");
+    }
+    kid = find(n, pid);
+    if (kid != NULL && kid->pi_state == PS_ZOMBIE) {
+      break;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    printf("%5d %5d %d %2u %6u %4u %4u %s\n",
+           procs[i].pi_pid, procs[i].pi_ppid, procs[i].pi_state,
+           procs[i].pi_nthreads, procs[i].pi_cputicks,
+           procs[i].pi_recent, procs[i].pi_respages, procs[i].pi_name);
+  }
+
+  me = find(n, self);
+  TEST_EQUAL(me != NULL, 1, "lists this process");
+  if (me != NULL) {
+    TEST_EQUAL(me->pi_state, PS_RUN, "this process is running");
+    TEST_EQUAL(me->pi_nthreads, 1, "this process has one thread");
+    TEST_POSITIVE(me->pi_respages, "this process has memory");
+    TEST_EQUAL(strcmp(me->pi_name, "pstest"), 0, "name is set");
+  }
+  kid = find(n, pid);
+  TEST_EQUAL(kid != NULL, 1, "lists the child");
+  if (kid != NULL) {
+    TEST_EQUAL(kid->pi_ppid, self, "child's parent");
+    TEST_EQUAL(kid->pi_state, PS_ZOMBIE, "child is a zombie");
+  }
+  TEST_EQUAL(n < 2 || procs[0].pi_pid < procs[1].pi_pid, 1, "pids ascend");
+
+  TEST_POSITIVE(ss.ss_ncpus, "system figures: cpus");
+  TEST_POSITIVE(ss.ss_hz, "system figures: hz");
+  TEST_EQUAL(ss.ss_nprocs >= (unsigned)n, 1, "system figures: nprocs");
+  TEST_POSITIVE(ss.ss_heapused, "system figures: heap used");
+  TEST_POSITIVE(ss.ss_heappages, "system figures: heap pages");
+
+  r = procstat(NULL, 0, &ss);
+  TEST_EQUAL(r, 0, "count only");
+  TEST_EQUAL(ss.ss_nprocs >= 2, 1, "count only");
+  r = procstat(procs, 1, NULL);
+  TEST_EQUAL(r, 1, "short buffer");
+  r = procstat(procs, -1, NULL);
+  TEST_NEGATIVE(r, "negative count");
+  TEST_EQUAL(errno, EINVAL, "negative count");
+  r = procstat((struct procinfo *)0x40000000, MAXPROCS, NULL);
+  TEST_NEGATIVE(r, "bad pointer");
+  TEST_EQUAL(errno, EFAULT, "bad pointer");
+
+  r = waitpid(pid, &status, 0);
+  TEST_EQUAL(r, pid, "child reaped");
+  TEST_EQUAL(WIFEXITED(status), 1, "child reaped");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * rusagetest - check getrusage and wait4
+ *
+ *  relies on fork, _exit, wait4, getrusage, and console write
+ *
+ *  spins until its own user time shows up, then forks a child that
+ *  does the same and collects it with wait4, and checks that the
+ *  child's usage comes back from wait4 and is added to
+ *  RUSAGE_CHILDREN. cpu time is sampled on clock ticks, so the spins
+ *  run until a tick lands on them rather than for a fixed count.
+ *  failures are reported as they happen, then a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+/* give up on seeing a tick after this many rounds */
+#define MAXROUNDS 1000
+#define SPIN      10000
+
+/* volatile so the compiler keeps the delay loops */
+volatile int tot;
+
+static
+int
+nonzero(const struct timeval *tv)
+{
+  return tv->tv_sec > 0 || tv->tv_usec > 0;
+}
+
+/* spin until some user time has been charged; returns 0 on success */
+static
+int
+burn(void)
+{
+  struct rusage ru;
+  int i, j;
+
+  for (i = 0; i < MAXROUNDS; i++) {
+    tot = 0;
+    for (j = 0; j < SPIN; j++) {
+      tot++;
+    }
+    if (getrusage(RUSAGE_SELF, &ru) < 0) {
+      return -1;
+    }
+    if (nonzero(&ru.ru_utime)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage ru, kid;
+  pid_t pid;
+  int status, r;
+
+  (void)argc;
+  (void)argv;
+
+  r = getrusage(RUSAGE_CHILDREN, &ru);
+  TEST_EQUAL(r, SUCCESS, "getrusage RUSAGE_CHILDREN");
+  TEST_EQUAL(nonzero(&ru.ru_utime), 0, "no children yet");
+
+  TEST_EQUAL(burn(), 0, "own user time");
+  r = getrusage(RUSAGE_SELF, &ru);
+  TEST_EQUAL(r, SUCCESS, "getrusage RUSAGE_SELF");
+  TEST_POSITIVE(ru.ru_minflt, "minor faults counted");
+
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    _exit(burn() == 0 ? 0 : 1);
+  }
+  r = wait4(pid, &status, 0, &kid);
+  TEST_EQUAL(r, pid, "wait4 reaps the child");
+  TEST_EQUAL(WIFEXITED(status) && WEXITSTATUS(status) == 0, 1,
+             "child exit status");
+  TEST_EQUAL(nonzero(&kid.ru_utime), 1,
+             "wait4 returns the child's user time");
+
+  r = getrusage(RUSAGE_CHILDREN, &ru);
+  TEST_EQUAL(r, SUCCESS, "getrusage RUSAGE_CHILDREN");
+  TEST_EQUAL(ru.ru_utime.tv_sec > kid.ru_utime.tv_sec ||
+             (ru.ru_utime.tv_sec == kid.ru_utime.tv_sec &&
+              ru.ru_utime.tv_usec >= kid.ru_utime.tv_usec), 1,
+             "RUSAGE_CHILDREN includes the child");
+
+  r = getrusage(1, &ru);
+  TEST_NEGATIVE(r, "bad who");
+  TEST_EQUAL(errno, EINVAL, "bad who");
+  r = getrusage(RUSAGE_SELF, NULL);
+  TEST_NEGATIVE(r, "bad pointer");
+  TEST_EQUAL(errno, EFAULT, "bad pointer");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
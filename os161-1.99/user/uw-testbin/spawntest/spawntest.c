@@ -0,0 +1,75 @@
+/*
+ * spawntest - check spawn
+ *
+ *  relies on spawn, waitpid, and console write
+ *
+ *  spawns argtest with some arguments (its output shows whether they
+ *  arrived), then true and false, and checks the error cases.
+ *  failures are reported as they happen, then a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+static char *argtestargv[4] = { (char *)"argtest", (char *)"first",
+                                (char *)"second", NULL };
+static char *trueargv[2] = { (char *)"true", NULL };
+static char *falseargv[2] = { (char *)"false", NULL };
+static char *noneargv[2] = { (char *)"nonexistent", NULL };
+
+static const int stdfds[3] = { 0, 1, 2 };
+static const int badfds[3] = { 0, 1, 42 };
+
+/* exit code of the spawned child, or -1 */
+static
+int
+run(const char *prog, char **argv, const int *fds, int nfds)
+{
+  pid_t pid;
+  int status;
+
+  pid = spawn(prog, argv, fds, nfds);
+  if (pid < 0) {
+    warn("spawn %s", prog);
+    return -1;
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    warn("waitpid");
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  pid_t pid;
+
+  (void)argc;
+  (void)argv;
+
+  TEST_EQUAL(run("/uw-testbin/argtest", argtestargv, NULL, 0), 0,
+             "argtest with arguments");
+  TEST_EQUAL(run("/bin/true", trueargv, stdfds, 3), 0, "true");
+  TEST_EQUAL(run("/bin/false", falseargv, NULL, 0), 1, "false");
+
+  pid = spawn("/nonexistent", noneargv, NULL, 0);
+  TEST_NEGATIVE(pid, "nonexistent program");
+  TEST_EQUAL(errno, ENOENT, "nonexistent program");
+  pid = spawn("/bin/true", trueargv, badfds, 3);
+  TEST_NEGATIVE(pid, "bad descriptor");
+  TEST_EQUAL(errno, EBADF, "bad descriptor");
+  pid = spawn("/bin/true", trueargv, NULL, -1);
+  TEST_NEGATIVE(pid, "negative descriptor count");
+  TEST_EQUAL(errno, EINVAL, "negative descriptor count");
+  pid = spawn("/bin/true", NULL, NULL, 0);
+  TEST_NEGATIVE(pid, "null argv");
+  TEST_EQUAL(errno, EFAULT, "null argv");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
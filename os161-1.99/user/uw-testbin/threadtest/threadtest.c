@@ -0,0 +1,220 @@
+/*
+ * threadtest - check thread_create, thread_exit and thread_join
+ *
+ *  relies on thread_create, thread_exit, thread_join, futex_wait,
+ *  futex_wake, fork, _exit, waitpid, and console write
+ *
+ *  sums an array in parallel, hands off through a futex so that a
+ *  thread really sleeps in futex_wait, checks the thread limit and
+ *  the join errors, and then, in child processes, that _exit from
+ *  one thread ends the others and that the process exits with 0 when
+ *  its last thread does. failures are reported as they happen, then
+ *  a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+#define NWORKERS 4
+#define NVALS    4096
+#define SPIN     200000
+
+static int vals[NVALS];
+static volatile int gate;
+static volatile int spins;
+
+static
+void
+spin(int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    spins++;
+  }
+}
+
+/* sum one NWORKERS'th of vals */
+static
+void *
+sum(void *arg)
+{
+  int part = (int)arg;
+  int i, total;
+
+  total = 0;
+  for (i = part; i < NVALS; i += NWORKERS) {
+    total += vals[i];
+  }
+  return (void *)total;
+}
+
+/* sleep until gate opens */
+static
+void *
+waitgate(void *arg)
+{
+  (void)arg;
+  while (gate == 0) {
+    futex_wait(&gate, 0);
+  }
+  return (void *)1;
+}
+
+static
+void *
+spinforever(void *arg)
+{
+  (void)arg;
+  while (1) {
+    spins++;
+  }
+  return NULL;
+}
+
+static
+void *
+exitprocess(void *arg)
+{
+  spin(SPIN);
+  _exit((int)arg);
+}
+
+static
+void *
+spinreturn(void *arg)
+{
+  spin(SPIN);
+  return arg;
+}
+
+static
+int
+child_status(pid_t pid)
+{
+  int status;
+
+  if (waitpid(pid, &status, 0) != pid) {
+    return -1;
+  }
+  return status;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tids[THREAD_MAX];
+  void *ret;
+  int i, n, total, expect, good, status;
+  pid_t pid;
+
+  (void)argc;
+  (void)argv;
+
+  /* parallel sum */
+  expect = 0;
+  for (i = 0; i < NVALS; i++) {
+    vals[i] = i * 7 + 1;
+    expect += vals[i];
+  }
+  good = 1;
+  for (i = 0; i < NWORKERS; i++) {
+    tids[i] = thread_create(sum, (void *)i);
+    if (tids[i] <= 0) {
+      err(1, "thread_create");
+    }
+  }
+  total = 0;
+  for (i = 0; i < NWORKERS; i++) {
+    if (thread_join(tids[i], &ret) < 0) {
+      good = 0;
+      continue;
+    }
+    total += (int)ret;
+  }
+  TEST_EQUAL(good, 1, "threads join");
+  TEST_EQUAL(total, expect, "parallel sum");
+
+  /* blocking futex handoff */
+  gate = 0;
+  tids[0] = thread_create(waitgate, NULL);
+  spin(SPIN);
+  gate = 1;
+  n = futex_wake(&gate, 1);
+  ret = NULL;
+  TEST_POSITIVE(tids[0], "thread_create");
+  TEST_EQUAL(n >= 0, 1, "futex_wake");
+  TEST_EQUAL(thread_join(tids[0], &ret), SUCCESS, "thread_join");
+  TEST_EQUAL((int)ret, 1, "futex wakes a sleeping thread");
+
+  /* the limit, counting the main thread */
+  gate = 0;
+  good = 1;
+  for (i = 1; i < THREAD_MAX; i++) {
+    tids[i] = thread_create(waitgate, NULL);
+    if (tids[i] <= 0) {
+      good = 0;
+    }
+  }
+  TEST_EQUAL(good, 1, "THREAD_MAX threads");
+  n = thread_create(waitgate, NULL);
+  TEST_NEGATIVE(n, "one too many");
+  TEST_EQUAL(errno, EAGAIN, "one too many");
+  gate = 1;
+  futex_wake(&gate, THREAD_MAX);
+  for (i = 1; i < THREAD_MAX; i++) {
+    if (tids[i] > 0 && thread_join(tids[i], NULL) < 0) {
+      good = 0;
+    }
+  }
+  TEST_EQUAL(good, 1, "joining them all");
+
+  /* join errors */
+  n = thread_join(0, NULL);
+  TEST_NEGATIVE(n, "join self");
+  TEST_EQUAL(errno, EINVAL, "join self");
+  n = thread_join(tids[1], NULL);
+  TEST_NEGATIVE(n, "join twice");
+  TEST_EQUAL(errno, ESRCH, "join twice");
+  n = thread_join(THREAD_MAX, NULL);
+  TEST_NEGATIVE(n, "join bad id");
+  TEST_EQUAL(errno, ESRCH, "join bad id");
+
+  /* _exit in one thread ends the process */
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    thread_create(spinforever, NULL);
+    gate = 0;
+    thread_create(waitgate, NULL);
+    n = thread_create(exitprocess, (void *)7);
+    thread_join(n, NULL);
+    _exit(1);
+  }
+  status = child_status(pid);
+  TEST_EQUAL(WIFEXITED(status) && WEXITSTATUS(status) == 7, 1,
+             "_exit from a thread ends them all");
+
+  /* the last thread out exits the process with 0 */
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    thread_create(spinreturn, NULL);
+    thread_exit(NULL);
+  }
+  status = child_status(pid);
+  TEST_EQUAL(WIFEXITED(status) && WEXITSTATUS(status) == 0, 1,
+             "last thread_exit exits with 0");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * vforktest - check vfork
+ *
+ *  relies on vfork, execv, _exit, waitpid, and console write
+ *
+ *  checks that a vforked child runs in the parent's memory, that the
+ *  parent doesn't run again until the child has exited or exec'd,
+ *  and that a failed execv leaves the child able to _exit.
+ *  failures are reported as they happen, then a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+static char *trueargv[2] = { (char *)"true", NULL };
+static char *noneargv[2] = { (char *)"nonexistent", NULL };
+
+/* written by the children, read by the parent */
+static volatile int shared;
+
+static
+int
+reap(pid_t pid)
+{
+  int status;
+
+  if (waitpid(pid, &status, 0) < 0) {
+    warn("waitpid");
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  pid_t pid;
+
+  (void)argc;
+  (void)argv;
+
+  shared = 0;
+  pid = vfork();
+  if (pid < 0) {
+    err(1, "vfork");
+  }
+  if (pid == 0) {
+    shared = 1;
+    _exit(3);
+  }
+  TEST_EQUAL(shared, 1, "child writes the parent's memory");
+  TEST_EQUAL(reap(pid), 3, "child exit status");
+
+  shared = 0;
+  pid = vfork();
+  if (pid < 0) {
+    err(1, "vfork");
+  }
+  if (pid == 0) {
+    shared = 1;
+    execv("/bin/true", trueargv);
+    _exit(1);
+  }
+  TEST_EQUAL(shared, 1, "parent waits for execv");
+  TEST_EQUAL(reap(pid), 0, "exec'd child exit status");
+
+  pid = vfork();
+  if (pid < 0) {
+    err(1, "vfork");
+  }
+  if (pid == 0) {
+    execv("/nonexistent", noneargv);
+    _exit(7);
+  }
+  TEST_EQUAL(reap(pid), 7, "failed execv, then _exit");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * waitany - check waitpid with WNOHANG and with pid -1 (any child)
+ *
+ *  relies on fork, _exit, waitpid, and console write
+ *
+ *  forks a few children that busy-wait for different lengths of time
+ *  and exit with different codes, polls one of them with WNOHANG
+ *  while it is still running, then collects them all with pid -1,
+ *  in whatever order they finish. failures are reported as they
+ *  happen, then a summary is printed.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+#include "../lib/testutils.h"
+
+#define NKIDS 4
+#define SPIN  200000
+
+/* volatile so the compiler keeps the children's delay loops */
+volatile int tot;
+
+static pid_t kids[NKIDS];
+
+int
+main(int argc, char *argv[])
+{
+  pid_t pid;
+  int i, j, status, seen, good, r;
+
+  (void)argc;
+  (void)argv;
+
+  for (i = 0; i < NKIDS; i++) {
+    pid = fork();
+    if (pid < 0) {
+      err(1, "fork");
+    }
+    if (pid == 0) {
+      /* the last child forked finishes first */
+      tot = 0;
+      for (j = 0; j < (NKIDS - i) * SPIN; j++) {
+        tot++;
+      }
+      _exit(i + 1);
+    }
+    kids[i] = pid;
+  }
+
+  r = waitpid(kids[0], &status, WNOHANG);
+  TEST_EQUAL(r, 0, "WNOHANG on a running child");
+
+  seen = 0;
+  good = 1;
+  for (i = 0; i < NKIDS; i++) {
+    pid = waitpid(-1, &status, 0);
+    for (j = 0; j < NKIDS && kids[j] != pid; j++) {
+      /* nothing */
+    }
+    if (pid < 0 || j == NKIDS || (seen & (1 << j)) ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != j + 1) {
+      good = 0;
+      continue;
+    }
+    seen |= 1 << j;
+  }
+  TEST_EQUAL(good, 1, "waitpid -1 collects every child once");
+
+  r = waitpid(-1, &status, 0);
+  TEST_NEGATIVE(r, "waitpid -1 with no children");
+  TEST_EQUAL(errno, ECHILD, "waitpid -1 with no children");
+  r = waitpid(-1, &status, WNOHANG);
+  TEST_NEGATIVE(r, "WNOHANG with no children");
+  TEST_EQUAL(errno, ECHILD, "WNOHANG with no children");
+  r = waitpid(kids[0], &status, 0);
+  TEST_NEGATIVE(r, "waitpid on a reaped child");
+  TEST_EQUAL(errno, ESRCH, "waitpid on a reaped child");
+  r = waitpid(-1, &status, 0x100);
+  TEST_NEGATIVE(r, "bad options");
+  TEST_EQUAL(errno, EINVAL, "bad options");
+
+  TEST_STATS();
+  return test_failures() ? 1 : 0;
+}